@@ -0,0 +1,43 @@
+/*
+* Filename : AddMappingStats.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Adds one set of mapping counters, stage timing and per amplicon counts to another.
+* Status: Release
+*/
+
+#include <vector>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+//Totals.AmpliconStats is grown to Stats' amplicons
+void AddMappingStats(MappingStats& Totals, const MappingStats& Stats) {
+
+	Totals.nMaskedReads += Stats.nMaskedReads;
+	Totals.PrimerMatchedReads += Stats.PrimerMatchedReads;
+	Totals.OffTargetReads += Stats.OffTargetReads;
+	Totals.TotalUsableReads += Stats.TotalUsableReads;
+	Totals.TotalMappedReads += Stats.TotalMappedReads;
+	Totals.TotalNotMergedReads += Stats.TotalNotMergedReads;
+	Totals.AlignmentCacheHits += Stats.AlignmentCacheHits;
+	Totals.AlignmentCacheMisses += Stats.AlignmentCacheMisses;
+
+	for (unsigned s = 0; s < StageCount; ++s) {
+		Totals.Timing.Nanoseconds[s] += Stats.Timing.Nanoseconds[s];
+		Totals.Timing.Calls[s] += Stats.Timing.Calls[s];
+	}
+
+	if (Totals.AmpliconStats.size() < Stats.AmpliconStats.size()) {
+		Totals.AmpliconStats.resize(Stats.AmpliconStats.size(), Stat());
+	}
+
+	for (unsigned n = 0; n < Stats.AmpliconStats.size(); ++n) {
+		Totals.AmpliconStats[n].Usable += Stats.AmpliconStats[n].Usable;
+		Totals.AmpliconStats[n].Merged += Stats.AmpliconStats[n].Merged;
+		Totals.AmpliconStats[n].Mapped += Stats.AmpliconStats[n].Mapped;
+		Totals.AmpliconStats[n].Alignments += Stats.AmpliconStats[n].Alignments;
+		Totals.AmpliconStats[n].AlignmentNanoseconds += Stats.AmpliconStats[n].AlignmentNanoseconds;
+	}
+
+}
@@ -0,0 +1,209 @@
+/*
+* Filename : AlignReadPair.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Matches a read pair to its amplicon, merges and globally aligns it; optionally appends the SAM or BAM record to the supplied buffer.
+* Status: Release
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+//a rejected pair has no merged read, CIGAR or scores; clear keeps the buffers for the next pair
+static void RejectPair(PairAlignment& Result, const PairOutcome Outcome) {
+	Result.Outcome = Outcome;
+	Result.MapQ = 0;
+	Result.AS = 0;
+	Result.Cigar.Ops.clear();
+	Result.Cigar.NM = 0;
+	Result.MergedRead.first.clear();
+	Result.MergedRead.second.clear();
+}
+
+//Result.Outcome is the reason a pair was not mapped; Amplicon, Strand and Pos are kept once a primer pair has matched
+void AlignReadPair(ReadPair& Pair, const vector<AmpliconRecord>& AmpliconRecords, const PrimerIndex& LeftPrimerIndex, const AlignerParameters& Parameters,
+	ReadPairScratch& Scratch, vector<AlignmentCache>& AlignmentCaches, PairAlignment& Result, MappingStats& Stats) {
+
+	unsigned n, SingleBaseMisMatchFrequency;
+	const AlignmentProfile* Profile;
+	pair<string, string>& MergedRead = Result.MergedRead;
+	PackedCigar& Cigar = Result.Cigar;
+	int NWScore, Amplicon;
+	bool Aligned, Masked, Merged;
+	uint64_t Start = StageClock(), AlignmentStart;
+
+	Result.Amplicon = -1;
+	Result.Strand = true;
+	Result.Pos = 0;
+
+	//skip N masked reads
+	Masked = isReadNMasked(Pair.Seq1) == true || isReadNMasked(Pair.Seq2) == true;
+	Start = EndStage(Stats.Timing, StageNMask, Start);
+
+	if (Masked == true) {
+		RejectPair(Result, PairNMasked);
+		Stats.nMaskedReads++;
+		return;
+	}
+
+	//packed once; primer matching and merging compare 64 bases at a time
+	PackSequence(Pair.Seq1, Scratch.PackedR1);
+	PackSequence(Pair.Seq2, Scratch.PackedR2);
+
+	//first amplicon whose left primer matches R1; gapless alignment to position 0
+	Amplicon = MatchAmplicon(Scratch.PackedR1, AmpliconRecords, LeftPrimerIndex);
+
+	if (Amplicon >= 0 && MatchPrimer(Scratch.PackedR2, AmpliconRecords[Amplicon].RightPrimerPacked) == 0) {
+		Amplicon = -1; //if R1 primer matches do not continue looking for matches
+	}
+
+	Start = EndStage(Stats.Timing, StagePrimerMatch, Start);
+
+	if (Amplicon < 0) {
+		RejectPair(Result, PairNoPrimerMatch);
+		return;
+	}
+
+	n = Amplicon;
+	Profile = &AmpliconRecords[n].Alignment;
+	Result.Amplicon = Amplicon;
+	Result.Strand = AmpliconRecords[n].Strand;
+	Result.Pos = AmpliconRecords[n].Pos;
+
+	//read matches to this amplicon
+	Stats.PrimerMatchedReads++; //total number of ontarget reads
+
+	//mispriming; insert does not resemble the amplicon
+	if (isPairOffTarget(Scratch.PackedR1, Scratch.PackedR2, AmpliconRecords[n]) == true) {
+		RejectPair(Result, PairOffTarget);
+		Stats.OffTargetReads++;
+		EndStage(Stats.Timing, StageOffTarget, Start);
+		return;
+	}
+
+	Start = EndStage(Stats.Timing, StageOffTarget, Start);
+
+	//trim adapter
+	RightPrimerClipper(Pair.Seq1, Pair.Qual1, AmpliconRecords[n].RightPrimerClip);
+	RightPrimerClipper(Pair.Seq2, Pair.Qual2, AmpliconRecords[n].LeftPrimerClip);
+	Start = EndStage(Stats.Timing, StageClip, Start);
+
+	//reduce primer dimer; insert size less than minIsize ignored
+	if (Pair.Seq1.length() < AmpliconRecords[n].LeftPrimerLen + AmpliconRecords[n].RightPrimerLen + Parameters.MinIsize ||
+		Pair.Seq2.length() < AmpliconRecords[n].LeftPrimerLen + AmpliconRecords[n].RightPrimerLen + Parameters.MinIsize) {
+		RejectPair(Result, PairPrimerDimer);
+		return;
+	}
+
+	Stats.AmpliconStats[n].Usable++; //usable reads by amplicon
+	Stats.TotalUsableReads++;
+
+	//merge reads into 1 contig
+	Merged = ReadMerger(Pair.Seq1, Pair.Qual1, Pair.Seq2, Pair.Qual2, Scratch.PackedR1, Scratch.PackedR2, Parameters.MaxQScore, Parameters.QScorePhredOffset, Scratch.ReverseR2, MergedRead); //MergedRead contains seq and qual merged
+
+	//convert read to + strand for Alignment; the reference was converted by GetAmplicons
+	if (Merged == true && AmpliconRecords[n].Strand == false) { //is+Strand
+
+		//Query must be reverse ConvertDNAComplemented to Reflect + strand
+		ReverseComplement(MergedRead.first, Scratch.ReverseR2.first);
+		MergedRead.first.assign(Scratch.ReverseR2.first); //copied so each Result keeps its own buffer
+		reverse(MergedRead.second.begin(), MergedRead.second.end());
+
+	}
+
+	Start = EndStage(Stats.Timing, StageMerge, Start);
+
+	if (Merged == false) {
+		RejectPair(Result, PairNotMerged);
+		Stats.TotalNotMergedReads++;
+		return;
+	}
+
+	Stats.AmpliconStats[n].Merged++; //merged reads
+
+	/*TODO: need to iterate over all possilble reference sequences including off-target here*/
+
+	AlignmentStart = Start;
+
+	//reads with substitutions only are aligned directly; repeated sequences reuse their alignment
+	//qualities always come from this read
+	if (UngappedAlignment(AmpliconRecords[n].RefSeq, MergedRead.first, Profile->LeftPrimerLen, Profile->RightPrimerLen, NWScore, Cigar, SingleBaseMisMatchFrequency) == 0) {
+		Aligned = true;
+		Start = EndStage(Stats.Timing, StageAlign, Start);
+	} else if (FindCachedAlignment(AlignmentCaches[n], MergedRead.first, Aligned, NWScore, Cigar, SingleBaseMisMatchFrequency) == true) {
+		Stats.AlignmentCacheHits++;
+		Start = EndStage(Stats.Timing, StageAlign, Start);
+	} else {
+
+		Stats.AlignmentCacheMisses++;
+
+		//global pairwise Alignment; match 1 mismatch -3 gapopen -8 gapextend -1
+		Aligned = BandedGlobalAlignment(*Profile, MergedRead.first, Parameters.MaxIndel, Scratch.Alignment, NWScore, Cigar) == 0;
+		Start = EndStage(Stats.Timing, StageAlign, Start);
+
+		//soft clip primers and calculate edit distance; text or binary only at output
+		if (Aligned == true) {
+			Aligned = getCigarNM(AmpliconRecords[n].RefSeq, MergedRead.first, Profile->LeftPrimerLen, Profile->RightPrimerLen, Cigar, SingleBaseMisMatchFrequency) == 0;
+			Start = EndStage(Stats.Timing, StageCigar, Start);
+		}
+
+		CacheAlignment(AlignmentCaches[n], MergedRead.first, Aligned, NWScore, Cigar, SingleBaseMisMatchFrequency);
+	}
+
+	Stats.AmpliconStats[n].Alignments++;
+	Stats.AmpliconStats[n].AlignmentNanoseconds += Start - AlignmentStart;
+
+	if (Aligned == false) {
+		RejectPair(Result, PairNotAligned);
+		return; //poor Alignment; discard this read and proceed to next
+	} else if ((float)SingleBaseMisMatchFrequency / AmpliconRecords[n].RefSeq.length() > Parameters.MaxSingleBaseMisMatch) { //too many single base mismatches (false alignment)
+		RejectPair(Result, PairMismatched);
+		return;
+	}
+
+	Result.Outcome = PairMapped;
+	Result.AS = NWScore;
+	Result.MapQ = NWScore > 60 ? 60 : NWScore; //downscale mapping score in acceptable range
+
+	Stats.AmpliconStats[n].Mapped++; //mapped reads by amplicon
+	Stats.TotalMappedReads++;
+}
+
+//a mapped pair's SAM text or BAM record; Pair is as clipped by AlignReadPair
+void AppendPairRecord(string& SamRecords, const ReadPair& Pair, const PairAlignment& Result, const vector<AmpliconRecord>& AmpliconRecords,
+	const AlignerParameters& Parameters, const string& ReadGroup) {
+
+	if (Parameters.Format == BamOutput) {
+
+		AppendBamRecord(SamRecords, Pair.Header, Result.Strand == true ? 0 : 16, AmpliconRecords[Result.Amplicon].RefID, Result.Pos,
+			Result.MapQ, Result.Cigar.Ops, Result.MergedRead.first, Result.MergedRead.second, Parameters.QScorePhredOffset,
+			ReadGroup, Result.Cigar.NM, Result.AS, AmpliconRecords[Result.Amplicon].ID);
+
+	} else {
+
+		AppendSamRecord(SamRecords, Pair.Header, AmpliconRecords[Result.Amplicon], Result.MapQ, Result.Cigar.Ops, Result.MergedRead.first, Result.MergedRead.second,
+			ReadGroup, Result.Cigar.NM, Result.AS);
+
+	}
+
+}
+
+//mapped pairs are appended to SamRecords as SAM text or BAM records
+void AlignReadPair(ReadPair& Pair, const vector<AmpliconRecord>& AmpliconRecords, const PrimerIndex& LeftPrimerIndex, const AlignerParameters& Parameters,
+	const string& ReadGroup, ReadPairScratch& Scratch, vector<AlignmentCache>& AlignmentCaches, string& SamRecords, MappingStats& Stats) {
+
+	AlignReadPair(Pair, AmpliconRecords, LeftPrimerIndex, Parameters, Scratch, AlignmentCaches, Scratch.Result, Stats);
+
+	if (Scratch.Result.Outcome == PairMapped) {
+		uint64_t Start = StageClock();
+		AppendPairRecord(SamRecords, Pair, Scratch.Result, AmpliconRecords, Parameters, ReadGroup);
+		EndStage(Stats.Timing, StageFormat, Start);
+	}
+
+}
@@ -0,0 +1,367 @@
+/*
+* Filename : AlignSample.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Aligns one sample's read pairs on a shared pipeline and writes its SAM/BAM, mapping stats and stage timing, or one shard of them.
+* Status: Release
+*/
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include "AmpliconAlignerV2.h"
+#include "ReadPairPipeline.h"
+#include "BgzfStreamBuf.h"
+#include "SortedBamStreamBuf.h"
+#include "AsyncFileStreamBuf.h"
+#include "FastqReader.h"
+
+using namespace std;
+
+/*									Method
+A shard aligns the read pairs in Parameters.FirstPair to LastPair of the input batches numbered Shard - 1 modulo Shards,
+and writes them with the full header to a SAM/BAM named after the shard (e.g. Prefix_shard2of4) plus a _ShardStats.txt in
+place of the mapping stats and stage timing. Every shard reads the first reads to check the FASTQs and name the read
+group. The pairs behind each submitted batch and the bytes written for it are recorded so MergeShards can interleave the
+shards' records in input order.
+*/
+
+bool AlignSample(const SampleFiles& Sample, const AmpliconPanel& Panel, const AlignerParameters& Parameters, const string& CommandLine, const float Version,
+	const unsigned Threads, ReadPairPipeline& Pipeline) {
+
+	const unsigned BatchSize = 4096; //read pairs handed to a worker at once
+	const bool Interleaved = Sample.R2FASTQ.empty();
+	const vector<AmpliconRecord>& AmpliconRecords = Panel.AmpliconRecords;
+	const vector<string>& SamHeaders = Panel.SamHeaders;
+	const bool Sharded = Parameters.Shards > 1 || Parameters.FirstPair > 1 || Parameters.LastPair != ULONG_MAX;
+
+	unsigned TotalReads = 0, n, SampleNo = 0;
+	unsigned long InputPairs = 0, FirstSelected = 0;
+	size_t Records, Selected, r;
+	bool InputEnded = false, Added = false; //Added once the sample holds a slot in the shared pipeline
+	string Index, FlowCellID, ReadGroup, Prefix = Sample.Prefix, OutputPrefix = Sample.Prefix, R1FASTQ = Sample.R1FASTQ, R2FASTQ = Interleaved ? Sample.R1FASTQ : Sample.R2FASTQ;
+	string_view Header, Read1Line, Read2Line;
+	string HeaderText, BamHeader;
+	ReadPairBatch Batch;
+	vector<FastqRecord> Records1, Records2;
+	MappingStats Totals;
+	ShardStats Shard = ShardStats();
+	vector<uint64_t> BatchBytes; //written for each submitted batch
+	vector<string> AmpliconIDs;
+	StageTiming ReaderTiming = StageTiming();
+	uint64_t ParseStart, RunStart = StageClock(); //wall time for the stage timing file
+
+	//shard outputs are named after their pairs; the read group and sample stay the sample's
+	if (Parameters.Shards > 1) {
+		OutputPrefix += "_shard" + to_string(Parameters.Shard) + "of" + to_string(Parameters.Shards);
+	}
+	if (Parameters.FirstPair > 1 || Parameters.LastPair != ULONG_MAX) {
+		OutputPrefix += "_pairs" + to_string(Parameters.FirstPair) + "-" + (Parameters.LastPair == ULONG_MAX ? "end" : to_string(Parameters.LastPair));
+	}
+
+	//filstreams
+	FastqReader R1_in(R1FASTQ);
+	unique_ptr<FastqReader> R2_in(Interleaved ? NULL : new FastqReader(R2FASTQ)); //R2 records follow R1 records if interleaved
+	unique_ptr<BgzfStreamBuf> BAM_buf;
+	unique_ptr<SortedBamStreamBuf> SortedBAM_buf;
+	unique_ptr<AsyncFileStreamBuf> SAM_buf;
+	unique_ptr<ostream> Alignments_out;
+
+	if (Parameters.Format == BamOutput && Parameters.SortOutput == true) {
+		SortedBAM_buf.reset(new SortedBamStreamBuf(Prefix + ".bam", Threads, Panel.References.size(), Parameters.SortMemory));
+		Alignments_out.reset(new ostream(SortedBAM_buf.get()));
+		if (!SortedBAM_buf->is_open()) {
+			Alignments_out->setstate(ios_base::failbit);
+		}
+	} else if (Parameters.Format == BamOutput) {
+		BAM_buf.reset(new BgzfStreamBuf(OutputPrefix + ".bam", Threads));
+		Alignments_out.reset(new ostream(BAM_buf.get()));
+		if (!BAM_buf->is_open()) {
+			Alignments_out->setstate(ios_base::failbit);
+		}
+	} else {
+		SAM_buf.reset(new AsyncFileStreamBuf(OutputPrefix + ".sam")); //written on its own thread
+		Alignments_out.reset(new ostream(SAM_buf.get()));
+		if (!SAM_buf->is_open()) {
+			Alignments_out->setstate(ios_base::failbit);
+		}
+	}
+
+	ostream& SAM_out = *Alignments_out;
+
+	try
+	{
+		//parse FASTQs
+		if (R1_in.is_open() && (Interleaved || R2_in->is_open())) {
+
+			ParseStart = StageClock();
+
+			while ((Records = Interleaved ? R1_in.GetBatch(Records1, 2 * BatchSize, Batch.Buffers) :
+				min(R1_in.GetBatch(Records1, BatchSize, Batch.Buffers), R2_in->GetBatch(Records2, BatchSize, Batch.Buffers))) > 0) {
+
+				//an interleaved batch is only odd if the stream ends with an R1 record that has no R2
+				if (Interleaved && Records % 2 != 0) {
+					throw runtime_error(R1FASTQ + " ends with an unpaired read; interleaved FASTQ must alternate R1 and R2 records");
+				} else if (Interleaved) {
+					Records /= 2;
+				}
+
+				Batch.Pairs.resize(Records);
+				Selected = 0;
+
+				for (r = 0; r < Records; ++r) {
+
+					const FastqRecord& Record1 = Interleaved ? Records1[2 * r] : Records1[r];
+					const FastqRecord& Record2 = Interleaved ? Records1[2 * r + 1] : Records2[r];
+
+					Read1Line = Record1.Header;
+					Read2Line = Record2.Header;
+
+					Header = Read1Line.substr(1, Read1Line.find_first_of(' ') - 1);
+
+					InputPairs++;
+
+					if (InputPairs < 15) { //check the first few reads; nothing has been submitted yet
+
+						//check read Headers are the same in both files
+						if (Header != Read2Line.substr(1, Read2Line.find_first_of(' ') - 1)) {
+							std::cerr << "ERROR: Read header " << Header << " does not match " << Read2Line.substr(0, Read2Line.find_first_of(' ')) << endl;
+							std::cerr << "ERROR: FASTQ read headers are not synchronised" << endl;
+							return 1;
+						}
+
+						//check read no is correct
+						if (Read1Line.substr(Read1Line.find_first_of(' ') + 1, 1) != "1") {
+							std::cerr << "ERROR: " << R1FASTQ << " contains R" << Read1Line.substr(Read1Line.find_first_of(' ') + 1, 1) << " reads" << endl;
+							return 1;
+						}
+						if (Read2Line.substr(Read2Line.find_first_of(' ') + 1, 1) != "2") {
+							std::cerr << "ERROR: " << R2FASTQ << " contains R" << Read2Line.substr(Read2Line.find_first_of(' ') + 1, 1) << " reads" << endl;
+							return 1;
+						}
+
+						if (InputPairs == 1) {
+
+							//check the Index number is the same across FASTQs and reads
+							Index = Read1Line.substr(Read1Line.find_last_of(':') + 1, std::string::npos); //set Index no
+
+							if (Index != Read2Line.substr(Read2Line.find_last_of(':') + 1, std::string::npos)) {
+								std::cerr << "ERROR: Index in read Headers " << Read1Line << " and " << Read2Line << " do not match" << endl;
+								return 1;
+							}
+
+							FlowCellID = GetFlowCellID(string(Header)); //set flowcell ID
+							ReadGroup = Prefix + '_' + FlowCellID; //read by the workers; set before the first batch
+
+							//write SAM Headers to file
+							if (SAM_out.good()) {
+
+								if (SamHeaders.size() == 0) {
+									std::cerr << "ERROR: No SAM Headers were provided in the reference file. You must apply these manually to pass Picard validation." << endl;
+								}
+
+								AppendSamHeader(HeaderText, SamHeaders, ReadGroup, Prefix, CommandLine, Version);
+
+								if (SortedBAM_buf) {
+									AppendBamHeader(BamHeader, HeaderText, Panel.References);
+									SortedBAM_buf->SetHeader(BamHeader); //written when the records are sorted
+								} else if (Parameters.Format == BamOutput) {
+									AppendBamHeader(BamHeader, HeaderText, Panel.References);
+									SAM_out.write(BamHeader.data(), BamHeader.size());
+									BAM_buf->FlushBlock(); //header in its own blocks
+									Shard.HeaderBytes = BamHeader.size();
+								} else {
+									SAM_out << HeaderText;
+									Shard.HeaderBytes = HeaderText.size();
+								}
+
+							} else {
+								std::cerr << "ERROR: Could not write headers to SAM file. Check file is not in use." << endl;
+								return 1;
+							}
+
+
+						} else if (Index != Read1Line.substr(Read1Line.find_last_of(':') + 1, std::string::npos)) {
+							std::cerr << "ERROR: Read headers contain mixed indexes" << endl;
+							return 1;
+						} else if (Index != Read2Line.substr(Read2Line.find_last_of(':') + 1, std::string::npos)) {
+							std::cerr << "ERROR: Read headers contain mixed indexes" << endl;
+							return 1;
+						}
+
+					}
+
+					//pairs outside the shard are read but not aligned
+					if (Sharded && (InputPairs < Parameters.FirstPair || InputPairs > Parameters.LastPair || (InputPairs - 1) / BatchSize % Parameters.Shards != Parameters.Shard - 1)) {
+						continue;
+					}
+
+					if (Selected == 0) {
+						FirstSelected = InputPairs - 1;
+					}
+
+					TotalReads++;
+
+					//views into the input chunks held by the batch
+					Batch.Pairs[Selected].Header = Header;
+					Batch.Pairs[Selected].Seq1 = Record1.Seq;
+					Batch.Pairs[Selected].Seq2 = Record2.Seq;
+					Batch.Pairs[Selected].Qual1 = Record1.Qual;
+					Batch.Pairs[Selected].Qual2 = Record2.Qual;
+					Selected++;
+
+				}
+
+				Batch.Pairs.resize(Selected);
+				ParseStart = EndStage(ReaderTiming, StageParse, ParseStart); //includes waiting for decompression
+
+				if (Selected > 0) {
+					if (Sharded) {
+						Shard.Batches.push_back(ShardBatch{ FirstSelected, Selected, 0 }); //selected pairs of a batch are contiguous
+					}
+
+					//added after the first batch's header checks so a rejected sample leaves no slot pointing at this function's ReadGroup and SAM_out
+					if (!Added) {
+						SampleNo = Pipeline.AddSample(ReadGroup, SAM_out, Sharded ? &BatchBytes : NULL);
+						Added = true;
+					}
+
+					Pipeline.Submit(SampleNo, Batch);
+				} else {
+					Batch.Pairs.clear();
+					Batch.Buffers.clear();
+				}
+
+				if (Records < BatchSize) {
+					break; //one file has ended
+				} else if (InputPairs > Parameters.LastPair) {
+					break; //rest of the input is outside the shard; whether it ends here is not known
+				}
+
+				ParseStart = StageClock();
+
+			}
+
+			InputEnded = Records < BatchSize;
+
+			//wait for the writer; a sample with no pairs to align is added only to be finished
+			if (!Added) {
+				SampleNo = Pipeline.AddSample(ReadGroup, SAM_out, Sharded ? &BatchBytes : NULL);
+				Added = true;
+			}
+
+			Pipeline.FinishSample(SampleNo, Totals);
+			Added = false;
+
+			//reading happens outside the pipeline
+			R1_in.AddDecompressTiming(Totals.Timing);
+			if (R2_in) {
+				R2_in->AddDecompressTiming(Totals.Timing);
+			}
+			Totals.Timing.Nanoseconds[StageParse] += ReaderTiming.Nanoseconds[StageParse];
+			Totals.Timing.Calls[StageParse] += ReaderTiming.Calls[StageParse];
+
+		} else {
+			std::cerr << "ERROR: Unable to open FASTQ file(s)" << endl;
+			return 1;
+		}
+
+	} catch (exception& e) {
+
+		std::cerr << "ERROR: " << e.what() << endl;
+
+		//batches already submitted are written before the slot is released; other samples keep the pipeline
+		if (Added) {
+			try {
+				MappingStats Discarded;
+				Pipeline.FinishSample(SampleNo, Discarded);
+			} catch (exception&) {
+				//the pipeline has stopped and no longer reads the sample
+			}
+		}
+
+		return 1;
+	}
+
+	for (n = 0; n < AmpliconRecords.size(); ++n) {
+		AmpliconIDs.push_back(AmpliconRecords[n].ID);
+	}
+
+	if (Sharded) {
+
+		//partial stats for MergeShards
+		Shard.ReadGroup = ReadGroup;
+		Shard.CommandLine = CommandLine;
+		Shard.Version = Version;
+		Shard.Format = Parameters.Format;
+		Shard.Threads = Threads;
+		Shard.InputEnded = InputEnded;
+		Shard.InputPairs = InputPairs;
+		Shard.TotalReads = TotalReads;
+		Shard.AmpliconIDs = AmpliconIDs;
+
+		for (r = 0; r < Shard.Batches.size() && r < BatchBytes.size(); ++r) {
+			Shard.Batches[r].Bytes = BatchBytes[r];
+		}
+
+		//runs of consecutive pairs in one line
+		for (r = 1, n = 0; r < Shard.Batches.size(); ++r) {
+			if (Shard.Batches[n].FirstPair + Shard.Batches[n].Pairs == Shard.Batches[r].FirstPair) {
+				Shard.Batches[n].Pairs += Shard.Batches[r].Pairs;
+				Shard.Batches[n].Bytes += Shard.Batches[r].Bytes;
+			} else {
+				Shard.Batches[++n] = Shard.Batches[r];
+			}
+		}
+		Shard.Batches.resize(min(Shard.Batches.size(), (size_t) n + 1));
+
+	} else if (WriteMappingStats(Prefix + "_MappingStats.txt", ReadGroup, CommandLine, Version, TotalReads, Totals, AmpliconIDs) == 1) {
+		std::cerr << "ERROR: Could not write mapping stats file" << endl;
+		return 1;
+	}
+
+	if (SortedBAM_buf) {
+		if (SortedBAM_buf->close() == false) {
+			std::cerr << "ERROR: Could not write sorted BAM file or index. Check the files are not in use and there is space for " << Prefix << ".bam.tmp" << endl;
+			return 1;
+		}
+	} else if (Parameters.Format == BamOutput) {
+		if (BAM_buf->close() == false) {
+			std::cerr << "ERROR: Could not write BAM file. Check file is not in use." << endl;
+			return 1;
+		}
+		BAM_buf->AddStallTiming(Totals.Timing);
+	} else {
+		if (SAM_buf->close() == false) {
+			std::cerr << "ERROR: Could not write SAM file. Check file is not in use." << endl;
+			return 1;
+		}
+		SAM_buf->AddStallTiming(Totals.Timing);
+	}
+
+	if (Sharded) {
+		Shard.Totals = Totals;
+		Shard.WallSeconds = (StageClock() - RunStart) / 1e9;
+		if (WriteShardStats(OutputPrefix + "_ShardStats.txt", Shard) == 1) {
+			std::cerr << "ERROR: Could not write shard stats file" << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+#ifndef NO_STAGE_TIMING
+	//where the time went; machine readable
+	if (WriteStageTiming(Prefix + "_StageTiming.json", Totals, AmpliconIDs, Threads, (StageClock() - RunStart) / 1e9) == 1) {
+		std::cerr << "ERROR: Could not write stage timing file" << endl;
+		return 1;
+	}
+#endif
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+* Filename : AlignerEngine.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Holds a loaded amplicon panel and aligns batches of read pairs to structured results for embedding.
+* Status: Release
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "AmpliconAlignerV2.h"
+#include "AlignerEngine.h"
+
+using namespace std;
+
+AlignerEngine::AlignerEngine(const AlignerParameters& Parameters) : Parameters(Parameters) {
+}
+
+bool AlignerEngine::LoadPanel(const string& Filename) {
+
+	unsigned n;
+
+	Panel = AmpliconPanel();
+
+	//a compiled panel is mapped without parsing
+	if (!isCompiledPanel(Filename)) {
+
+		ifstream Amplicons_in(Filename);
+
+		if (GetAmplicons(Amplicons_in, Panel.AmpliconRecords, Panel.SamHeaders, Panel.LeftPrimerIndex) == 1) {
+			return 1;
+		}
+
+		Amplicons_in.close();
+
+	} else if (ReadCompiledPanel(Filename, Panel) == 1) {
+		return 1;
+	}
+
+	//BAM records refer to chromosomes by their @SQ index
+	if (Parameters.Format == BamOutput) {
+		if (GetSamReferences(Panel.SamHeaders, Panel.References) == 1) {
+			std::cerr << "ERROR: @SQ headers in the amplicon file must contain SN and LN fields." << endl;
+			return 1;
+		}
+		for (n = 0; n < Panel.AmpliconRecords.size(); ++n) {
+			if (Panel.AmpliconRecords[n].RefID < 0) {
+				std::cerr << "ERROR: " << Panel.AmpliconRecords[n].ID << " chromosome " << Panel.AmpliconRecords[n].Chrom << " has no @SQ header; required for BAM output." << endl;
+				return 1;
+			}
+		}
+	}
+
+	AlignmentCaches = vector<AlignmentCache>(Panel.AmpliconRecords.size());
+
+	return 0;
+}
+
+void AlignerEngine::AlignBatch(vector<ReadPair>& Pairs, vector<PairAlignment>& Results, MappingStats& Stats) {
+	AlignBatch(Pairs, AlignmentCaches, Results, Stats);
+}
+
+void AlignerEngine::AlignBatch(vector<ReadPair>& Pairs, vector<AlignmentCache>& AlignmentCaches, vector<PairAlignment>& Results, MappingStats& Stats) {
+
+	unique_ptr<ReadPairScratch> Scratch;
+
+	//scratch of a finished batch, or new if every one is in use
+	{
+		lock_guard<mutex> Lock(ScratchMutex);
+		if (FreeScratch.empty()) {
+			Scratch.reset(new ReadPairScratch());
+		} else {
+			Scratch = std::move(FreeScratch.back());
+			FreeScratch.pop_back();
+		}
+	}
+
+	if (Stats.AmpliconStats.size() < Panel.AmpliconRecords.size()) {
+		Stats.AmpliconStats.resize(Panel.AmpliconRecords.size(), Stat());
+	}
+
+	Results.resize(Pairs.size());
+
+	for (unsigned n = 0; n < Pairs.size(); ++n) {
+		AlignReadPair(Pairs[n], Panel.AmpliconRecords, Panel.LeftPrimerIndex, Parameters, *Scratch, AlignmentCaches, Results[n], Stats);
+	}
+
+	lock_guard<mutex> Lock(ScratchMutex);
+	FreeScratch.push_back(std::move(Scratch));
+}
+
+void AlignerEngine::ClearAlignmentCache() {
+	for (unsigned n = 0; n < AlignmentCaches.size(); ++n) {
+		AlignmentCaches[n].Slots.clear();
+	}
+}
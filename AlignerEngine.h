@@ -0,0 +1,43 @@
+/*
+* Filename : AlignerEngine.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Holds a loaded amplicon panel and aligns batches of read pairs to structured results for embedding.
+* Status: Release
+*/
+
+#ifndef ALIGNERENGINE_H
+#define ALIGNERENGINE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+class AlignerEngine {
+public:
+	explicit AlignerEngine(const AlignerParameters& Parameters);
+
+	bool LoadPanel(const string& Filename); //amplicon list or compiled panel; 1 on error
+	const AmpliconPanel& GetPanel() const { return Panel; }
+	const AlignerParameters& GetParameters() const { return Parameters; }
+
+	//Results[n] is Pairs[n]'s alignment; clipping shortens the pairs' views; Stats is added to
+	//may be called from several threads at once; reusing Results avoids allocation once grown to the longest read
+	void AlignBatch(vector<ReadPair>& Pairs, vector<PairAlignment>& Results, MappingStats& Stats);
+	//with the caller's alignment cache, e.g. one per sample
+	void AlignBatch(vector<ReadPair>& Pairs, vector<AlignmentCache>& AlignmentCaches, vector<PairAlignment>& Results, MappingStats& Stats);
+	void ClearAlignmentCache(); //between samples; not while a batch is being aligned
+
+private:
+	AlignerParameters Parameters;
+	AmpliconPanel Panel;
+	vector<AlignmentCache> AlignmentCaches; //by amplicon; shared by concurrent batches
+	vector<unique_ptr<ReadPairScratch>> FreeScratch; //one per concurrent batch; kept for reuse
+	mutex ScratchMutex;
+};
+
+#endif
@@ -0,0 +1,73 @@
+/*
+* Filename : AlignmentCache.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Remembers alignment results of merged reads so repeated sequences of an amplicon are aligned once.
+* Status: Release
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <functional>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+Alignment depends only on the merged sequence and the amplicon (reference, strand and primer lengths), so identical
+merged reads of one amplicon give identical NWScore, CIGAR and NM. Each amplicon has a fixed table of slots chosen by
+sequence hash; a new sequence replaces whatever occupied its slot, which bounds memory and keeps frequent sequences
+resident. Base qualities are not part of the key and are taken from each read.
+*/
+
+static size_t SequenceHash(const string& Seq) {
+	return hash<string_view>()(string_view(Seq));
+}
+
+//copies the cached result of Seq; false if not cached
+bool FindCachedAlignment(AlignmentCache& Cache, const string& Seq, bool& Aligned, int& NWScore, PackedCigar& Cigar, unsigned& SingleBaseMisMatchFrequency) {
+
+	size_t Hash = SequenceHash(Seq);
+	lock_guard<mutex> Lock(Cache.Lock);
+
+	if (Cache.Slots.empty()) {
+		return false;
+	}
+
+	const AlignmentCacheEntry& Entry = Cache.Slots[Hash % AlignmentCacheSlots];
+
+	if (Entry.Filled == false || Entry.Hash != Hash || Entry.Seq != Seq) {
+		return false;
+	}
+
+	Aligned = Entry.Aligned;
+	NWScore = Entry.NWScore;
+	Cigar.Ops = Entry.Cigar.Ops;
+	Cigar.NM = Entry.Cigar.NM;
+	SingleBaseMisMatchFrequency = Entry.SingleBaseMisMatchFrequency;
+
+	return true;
+}
+
+void CacheAlignment(AlignmentCache& Cache, const string& Seq, const bool Aligned, const int NWScore, const PackedCigar& Cigar, const unsigned SingleBaseMisMatchFrequency) {
+
+	size_t Hash = SequenceHash(Seq);
+	lock_guard<mutex> Lock(Cache.Lock);
+
+	if (Cache.Slots.empty()) {
+		Cache.Slots.resize(AlignmentCacheSlots, AlignmentCacheEntry());
+	}
+
+	AlignmentCacheEntry& Entry = Cache.Slots[Hash % AlignmentCacheSlots];
+
+	Entry.Filled = true;
+	Entry.Hash = Hash;
+	Entry.Seq = Seq;
+	Entry.Aligned = Aligned;
+	Entry.NWScore = NWScore;
+	Entry.Cigar.Ops = Cigar.Ops;
+	Entry.Cigar.NM = Cigar.NM;
+	Entry.SingleBaseMisMatchFrequency = SingleBaseMisMatchFrequency;
+}
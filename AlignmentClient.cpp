@@ -0,0 +1,199 @@
+/*
+* Filename : AlignmentClient.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Sends a sample's read pairs to the alignment server and writes the SAM and mapping stats it returns.
+* Status: Release
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <unistd.h>
+#include "AmpliconAlignerV2.h"
+#include "FastqReader.h"
+#include "AsyncFileStreamBuf.h"
+
+using namespace std;
+
+//sends Tag and Payload and reads the reply; an ERR reply is reported
+static bool Request(int Socket, const string& Tag, const string& Payload, string& ReplyTag, string& Reply) {
+
+	if (WriteFrame(Socket, Tag, Payload) == 1 || ReadFrame(Socket, ReplyTag, Reply) == 1) {
+		std::cerr << "ERROR: Lost connection to the alignment server" << endl;
+		return 1;
+	}
+
+	if (ReplyTag == "ERR ") {
+		std::cerr << "ERROR: Alignment server: " << Reply << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+//once a batch has been sent the server holds the sample open; ending it lets a rerun start again with the SAM header
+static void CloseConnection(int Socket, const string& SampleID, const bool Sent) {
+
+	string Tag, Reply;
+
+	if (Sent && WriteFrame(Socket, "DONE", SampleID) == 0) {
+		while (ReadFrame(Socket, Tag, Reply) == 0 && Tag != "DONE" && Tag != "ERR ") {
+			//replies to the batch that failed
+		}
+	}
+
+	close(Socket);
+}
+
+//the sample is named by its prefix, as when aligned from files
+bool RunAlignmentClient(const string& SocketPath, const SampleFiles& Sample) {
+
+	const unsigned BatchSize = 16384; //read pairs per request
+	const bool Interleaved = Sample.R2FASTQ.empty();
+	int Socket = ConnectSocket(SocketPath);
+	FastqReader R1_in(Sample.R1FASTQ);
+	unique_ptr<FastqReader> R2_in(Interleaved ? NULL : new FastqReader(Sample.R2FASTQ));
+	AsyncFileStreamBuf SAM_buf(Sample.Prefix + ".sam");
+	ostream SAM_out(&SAM_buf);
+	vector<FastqRecord> Records1, Records2;
+	vector<shared_ptr<const string>> Buffers;
+	string Payload, Tag, Reply;
+	ShardStats Batch, Totals = ShardStats();
+	size_t Records;
+	unsigned r;
+	bool Sent = false; //a batch has been sent
+
+	if (Socket < 0) {
+		std::cerr << "ERROR: Could not connect to the alignment server on " << SocketPath << endl;
+		return 1;
+	} else if (!R1_in.is_open() || (!Interleaved && !R2_in->is_open())) {
+		std::cerr << "ERROR: Unable to open FASTQ file(s)" << endl;
+		close(Socket);
+		return 1;
+	} else if (!SAM_buf.is_open()) {
+		std::cerr << "ERROR: Could not write SAM file. Check file is not in use." << endl;
+		close(Socket);
+		return 1;
+	}
+
+	Totals.Totals = MappingStats();
+
+	try {
+		while ((Records = Interleaved ? R1_in.GetBatch(Records1, 2 * BatchSize, Buffers) :
+			min(R1_in.GetBatch(Records1, BatchSize, Buffers), R2_in->GetBatch(Records2, BatchSize, Buffers))) > 0) {
+
+			//as when aligned from files
+			if (Interleaved && Records % 2 != 0) {
+				throw runtime_error(Sample.R1FASTQ + " ends with an unpaired read; interleaved FASTQ must alternate R1 and R2 records");
+			} else if (Interleaved) {
+				Records /= 2;
+			}
+
+			//sample ID line then R1 and R2 records alternating
+			Payload = Sample.Prefix + '\n';
+
+			for (r = 0; r < Records; ++r) {
+
+				const FastqRecord& Record1 = Interleaved ? Records1[2 * r] : Records1[r];
+				const FastqRecord& Record2 = Interleaved ? Records1[2 * r + 1] : Records2[r];
+
+				Payload.append(Record1.Header).append("\n").append(Record1.Seq).append("\n+\n").append(Record1.Qual).append("\n");
+				Payload.append(Record2.Header).append("\n").append(Record2.Seq).append("\n+\n").append(Record2.Qual).append("\n");
+			}
+
+			Buffers.clear();
+
+			if (Request(Socket, "BTCH", Payload, Tag, Reply) == 1) {
+				CloseConnection(Socket, Sample.Prefix, true);
+				return 1;
+			} else if (Tag != "SAM ") {
+				std::cerr << "ERROR: Unexpected reply " << Tag << " from the alignment server" << endl;
+				CloseConnection(Socket, Sample.Prefix, true);
+				return 1;
+			} else if (!Sent && (Reply.empty() || Reply[0] != '@')) {
+				std::cerr << "ERROR: Alignment server did not send the SAM header for " << Sample.Prefix << endl;
+				CloseConnection(Socket, Sample.Prefix, true);
+				return 1;
+			}
+
+			Sent = true;
+
+			SAM_out.write(Reply.data(), Reply.size());
+
+			//incremental counts
+			istringstream Stats_in;
+
+			if (ReadFrame(Socket, Tag, Reply) == 1 || Tag != "STAT") {
+				std::cerr << "ERROR: Lost connection to the alignment server" << endl;
+				CloseConnection(Socket, Sample.Prefix, true);
+				return 1;
+			}
+
+			Stats_in.str(Reply);
+
+			if (ReadShardStats(Stats_in, SocketPath, Batch) == 1) {
+				CloseConnection(Socket, Sample.Prefix, true);
+				return 1;
+			}
+
+			Totals.ReadGroup = Batch.ReadGroup;
+			Totals.CommandLine = Batch.CommandLine;
+			Totals.Version = Batch.Version;
+			Totals.TotalReads += Batch.TotalReads;
+			Totals.AmpliconIDs = Batch.AmpliconIDs;
+			AddMappingStats(Totals.Totals, Batch.Totals);
+
+			if (Records < BatchSize) {
+				break; //one file has ended
+			}
+
+		}
+	} catch (exception& e) {
+		std::cerr << "ERROR: " << e.what() << endl;
+		CloseConnection(Socket, Sample.Prefix, Sent);
+		return 1;
+	}
+
+	//release the sample's alignment cache on the server
+	if (Sent && Request(Socket, "DONE", Sample.Prefix, Tag, Reply) == 1) {
+		close(Socket);
+		return 1;
+	}
+
+	close(Socket);
+
+	if (SAM_buf.close() == false || SAM_out.fail()) {
+		std::cerr << "ERROR: Could not write SAM file. Check file is not in use." << endl;
+		return 1;
+	}
+
+	if (WriteMappingStats(Sample.Prefix + "_MappingStats.txt", Totals.ReadGroup, Totals.CommandLine, Totals.Version, Totals.TotalReads, Totals.Totals,
+		Totals.AmpliconIDs) == 1) {
+		std::cerr << "ERROR: Could not write mapping stats file" << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+//returns once the server has stopped accepting connections
+bool StopAlignmentServer(const string& SocketPath) {
+
+	int Socket = ConnectSocket(SocketPath);
+	string Tag, Reply;
+	bool Failed;
+
+	if (Socket < 0) {
+		std::cerr << "ERROR: Could not connect to the alignment server on " << SocketPath << endl;
+		return 1;
+	}
+
+	Failed = Request(Socket, "STOP", "", Tag, Reply);
+	close(Socket);
+
+	return Failed;
+}
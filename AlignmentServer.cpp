@@ -0,0 +1,387 @@
+/*
+* Filename : AlignmentServer.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Keeps the amplicon panel and worker threads resident and aligns batches of read pairs sent over a local socket.
+* Status: Release
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "AmpliconAlignerV2.h"
+#include "ReadPairPipeline.h"
+
+using namespace std;
+
+/*									Method
+Clients send BTCH frames holding a sample ID line then interleaved R1 and R2 FASTQ records, and are answered with a SAM
+frame of the batch's records, preceded by the SAM header on the sample's first batch, and a STAT frame with the batch's
+counts in the shard stats format. A sample belongs to the connection whose batch opened it and stays open in the
+pipeline, keeping its alignment cache, until a DONE frame or the end of that connection; batches of one sample are
+aligned in turn, batches of different samples share the worker threads. STOP shuts the server down once open
+connections have closed. Any error is answered with an ERR frame and the connection closed.
+*/
+
+typedef struct {
+	string ReadGroup; //read by the workers
+	unsigned SampleNo; //in the pipeline
+	ostringstream SAM_out; //records of the batch being aligned
+	bool HeaderSent;
+	bool Finished;
+	mutex Lock; //batches of one sample are aligned in turn
+} ServerSample;
+
+typedef struct {
+	const AmpliconPanel* Panel;
+	const string* CommandLine;
+	float Version;
+	unsigned Threads;
+	ReadPairPipeline* Pipeline;
+	map<string, shared_ptr<ServerSample>> Samples; //open samples by ID
+	mutex SamplesLock;
+	mutex InlineLock; //with one worker the pipeline aligns on the calling thread, one batch at a time
+	int Listener;
+	atomic<bool> Stopping;
+	atomic<bool> Failed; //the pipeline stopped on an error
+	unsigned Connections;
+	mutex ConnectionsLock;
+	condition_variable ConnectionClosed;
+} AlignmentServer;
+
+//FASTQ records from Start; R1 and R2 alternate
+static bool ParseInterleavedFastq(const string& Payload, size_t Start, vector<ReadPair>& Pairs, string& Error) {
+
+	string_view Lines[8], Read1Line, Read2Line;
+	size_t End;
+	unsigned l;
+
+	while (Start < Payload.size()) {
+
+		for (l = 0; l < 8; ++l) {
+
+			if (Start >= Payload.size()) {
+				Error = "Truncated FASTQ record";
+				return 1;
+			}
+
+			End = Payload.find('\n', Start);
+			if (End == string::npos) {
+				End = Payload.size();
+			}
+
+			Lines[l] = string_view(Payload.data() + Start, End - Start);
+			Start = End + 1;
+		}
+
+		Read1Line = Lines[0];
+		Read2Line = Lines[4];
+
+		if (Read1Line.substr(0, 1) != "@" || Read2Line.substr(0, 1) != "@" || Lines[2].substr(0, 1) != "+" || Lines[6].substr(0, 1) != "+" ||
+			Lines[1].size() != Lines[3].size() || Lines[5].size() != Lines[7].size()) {
+			Error = "Improperly formatted FASTQ record " + string(Read1Line);
+			return 1;
+		}
+
+		//check read Headers are paired
+		if (Read1Line.find_first_of(' ') == string::npos || Read2Line.find_first_of(' ') == string::npos ||
+			Read1Line.substr(1, Read1Line.find_first_of(' ') - 1) != Read2Line.substr(1, Read2Line.find_first_of(' ') - 1) ||
+			Read1Line.substr(Read1Line.find_first_of(' ') + 1, 1) != "1" || Read2Line.substr(Read2Line.find_first_of(' ') + 1, 1) != "2") {
+			Error = "Read header " + string(Read1Line) + " is not paired with " + string(Read2Line);
+			return 1;
+		}
+
+		ReadPair Pair;
+		Pair.Header = Read1Line.substr(1, Read1Line.find_first_of(' ') - 1);
+		Pair.Seq1 = Lines[1];
+		Pair.Qual1 = Lines[3];
+		Pair.Seq2 = Lines[5];
+		Pair.Qual2 = Lines[7];
+		Pairs.push_back(Pair);
+	}
+
+	return 0;
+}
+
+//returns the sample's SAM text and STAT frame for the batch; a sample opened by the batch is added to Owned
+static bool AlignBatch(AlignmentServer& Server, const string& Payload, set<string>& Owned, string& Sam, string& Stats, string& Error) {
+
+	const unsigned BatchSize = 4096; //read pairs handed to a worker at once
+	const vector<AmpliconRecord>& AmpliconRecords = Server.Panel->AmpliconRecords;
+	size_t SampleEnd = Payload.find('\n');
+	string SampleID = Payload.substr(0, SampleEnd);
+	vector<ReadPair> Pairs;
+	shared_ptr<ServerSample> Sample;
+	ShardStats Batch = ShardStats();
+	uint64_t Start = StageClock();
+	unsigned n;
+
+	if (SampleEnd == string::npos || SampleID.empty() || SampleID.find('\t') != string::npos) {
+		Error = "Batch has no sample ID";
+		return 1;
+	}
+
+	if (ParseInterleavedFastq(Payload, SampleEnd + 1, Pairs, Error) == 1) {
+		return 1;
+	}
+
+	//the first batch of a sample opens it
+	if (Pairs.size() > 0) {
+		lock_guard<mutex> Lock(Server.SamplesLock);
+		shared_ptr<ServerSample>& Open = Server.Samples[SampleID];
+
+		if (!Open) {
+			Open.reset(new ServerSample());
+			Open->ReadGroup = SampleID + '_' + GetFlowCellID(string(Pairs[0].Header)); //read by the workers; set before the first batch
+			Open->SampleNo = Server.Pipeline->AddSample(Open->ReadGroup, Open->SAM_out);
+			Open->HeaderSent = false;
+			Open->Finished = false;
+			Owned.insert(SampleID);
+		} else if (Owned.count(SampleID) == 0) {
+			Error = "Sample " + SampleID + " is being aligned by another client";
+			return 1;
+		}
+
+		Sample = Open;
+	}
+
+	Batch.CommandLine = *Server.CommandLine;
+	Batch.Version = Server.Version;
+	Batch.Format = SamOutput;
+	Batch.Threads = Server.Threads;
+	Batch.TotalReads = Pairs.size();
+	Batch.Totals.AmpliconStats.resize(AmpliconRecords.size(), Stat());
+
+	for (n = 0; n < AmpliconRecords.size(); ++n) {
+		Batch.AmpliconIDs.push_back(AmpliconRecords[n].ID);
+	}
+
+	if (Sample) {
+
+		lock_guard<mutex> Lock(Sample->Lock);
+		unique_lock<mutex> Inline(Server.InlineLock, defer_lock);
+
+		if (Sample->Finished) {
+			Error = "Sample " + SampleID + " has ended";
+			return 1;
+		}
+
+		if (!Sample->HeaderSent) {
+			AppendSamHeader(Sam, Server.Panel->SamHeaders, Sample->ReadGroup, SampleID, *Server.CommandLine, Server.Version);
+			Batch.HeaderBytes = Sam.size();
+			Sample->HeaderSent = true;
+		}
+
+		if (Server.Threads == 1) {
+			Inline.lock();
+		}
+
+		//the pairs point into Payload, which outlives the batches
+		for (n = 0; n < Pairs.size(); n += BatchSize) {
+			ReadPairBatch Reads;
+			Reads.Pairs.assign(Pairs.begin() + n, Pairs.begin() + min((size_t) n + BatchSize, Pairs.size()));
+			Server.Pipeline->Submit(Sample->SampleNo, Reads);
+		}
+
+		Server.Pipeline->FlushSample(Sample->SampleNo, Batch.Totals);
+
+		Batch.ReadGroup = Sample->ReadGroup;
+		Sam += Sample->SAM_out.str();
+		Sample->SAM_out.str("");
+	}
+
+	Batch.WallSeconds = (StageClock() - Start) / 1e9;
+
+	ostringstream Stats_out;
+	WriteShardStats(Stats_out, Batch);
+	Stats = Stats_out.str();
+
+	return 0;
+}
+
+//releases the sample's alignment cache
+static void FinishSample(AlignmentServer& Server, const string& SampleID) {
+
+	shared_ptr<ServerSample> Sample;
+	MappingStats Remaining;
+
+	{
+		lock_guard<mutex> Lock(Server.SamplesLock);
+		map<string, shared_ptr<ServerSample>>::iterator Open = Server.Samples.find(SampleID);
+
+		if (Open == Server.Samples.end()) {
+			return;
+		}
+
+		Sample = Open->second;
+		Server.Samples.erase(Open);
+	}
+
+	lock_guard<mutex> Lock(Sample->Lock);
+	Server.Pipeline->FinishSample(Sample->SampleNo, Remaining); //every batch has been flushed
+	Sample->Finished = true;
+}
+
+static void HandleConnection(AlignmentServer& Server, int Socket) {
+
+	set<string> Owned; //samples opened by this connection and not yet done
+	string Tag, Payload, Sam, Stats, Error;
+
+	while (ReadFrame(Socket, Tag, Payload) == 0) {
+
+		Error.clear();
+		Sam.clear();
+
+		try {
+
+			if (Tag == "BTCH") {
+
+				if (AlignBatch(Server, Payload, Owned, Sam, Stats, Error) == 0 && (WriteFrame(Socket, "SAM ", Sam) == 1 || WriteFrame(Socket, "STAT", Stats) == 1)) {
+					break; //client has gone
+				}
+
+			} else if (Tag == "DONE") {
+
+				if (Owned.erase(Payload) > 0) {
+					FinishSample(Server, Payload);
+				}
+
+				if (WriteFrame(Socket, "DONE", "") == 1) {
+					break;
+				}
+
+			} else if (Tag == "STOP") {
+
+				Server.Stopping = true;
+				shutdown(Server.Listener, SHUT_RDWR); //wakes accept
+				WriteFrame(Socket, "DONE", "");
+				break;
+
+			} else {
+				Error = "Unknown frame " + Tag;
+			}
+
+		} catch (exception& e) {
+			//the pipeline cannot align further batches
+			Error = e.what();
+			Server.Failed = true;
+			Server.Stopping = true;
+			shutdown(Server.Listener, SHUT_RDWR);
+		}
+
+		if (!Error.empty()) {
+			std::cerr << "ERROR: " << Error << endl;
+			WriteFrame(Socket, "ERR ", Error);
+			break;
+		}
+
+	}
+
+	close(Socket);
+
+	//samples of a client that failed or went away; a rerun starts them again with a header
+	for (set<string>::iterator SampleID = Owned.begin(); SampleID != Owned.end(); ++SampleID) {
+		try {
+			FinishSample(Server, *SampleID);
+		} catch (exception& e) {
+			//the pipeline has stopped; its error was reported with the batch
+		}
+	}
+
+	lock_guard<mutex> Lock(Server.ConnectionsLock);
+	Server.Connections--;
+	Server.ConnectionClosed.notify_all();
+}
+
+bool RunAlignmentServer(const string& SocketPath, AlignerEngine& Engine, const string& CommandLine, const float Version, const unsigned Threads) {
+
+	struct sockaddr_un Address = sockaddr_un();
+	struct stat SocketStat;
+	int Socket;
+
+	if (SocketPath.length() >= sizeof(Address.sun_path)) {
+		std::cerr << "ERROR: Socket path " << SocketPath << " is too long" << endl;
+		return 1;
+	}
+
+	//a socket left by a server that did not stop cleanly is replaced
+	if (lstat(SocketPath.c_str(), &SocketStat) == 0) {
+
+		if (!S_ISSOCK(SocketStat.st_mode)) {
+			std::cerr << "ERROR: " << SocketPath << " exists and is not a socket" << endl;
+			return 1;
+		} else if ((Socket = ConnectSocket(SocketPath)) >= 0) {
+			close(Socket);
+			std::cerr << "ERROR: A server is already listening on " << SocketPath << endl;
+			return 1;
+		}
+
+		unlink(SocketPath.c_str());
+	}
+
+	Address.sun_family = AF_UNIX;
+	SocketPath.copy(Address.sun_path, SocketPath.length());
+
+	ReadPairPipeline Pipeline(Threads, Engine);
+	AlignmentServer Server;
+
+	Server.Panel = &Engine.GetPanel();
+	Server.CommandLine = &CommandLine;
+	Server.Version = Version;
+	Server.Threads = Threads;
+	Server.Pipeline = &Pipeline;
+	Server.Stopping = false;
+	Server.Failed = false;
+	Server.Connections = 0;
+
+	if ((Server.Listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(Server.Listener, (struct sockaddr*) &Address, sizeof(Address)) != 0 ||
+		listen(Server.Listener, 16) != 0) {
+		std::cerr << "ERROR: Could not listen on " << SocketPath << endl;
+		if (Server.Listener >= 0) {
+			close(Server.Listener);
+		}
+		return 1;
+	}
+
+	//one thread per connection; the alignment work is shared by the pipeline's workers
+	while (!Server.Stopping) {
+
+		if ((Socket = accept(Server.Listener, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			break; //shut down by STOP
+		}
+
+		{
+			lock_guard<mutex> Lock(Server.ConnectionsLock);
+			Server.Connections++;
+		}
+
+		thread(HandleConnection, ref(Server), Socket).detach();
+	}
+
+	close(Server.Listener);
+	unlink(SocketPath.c_str());
+
+	//wait for open connections; Server and Pipeline are theirs until then
+	unique_lock<mutex> Lock(Server.ConnectionsLock);
+	Server.ConnectionClosed.wait(Lock, [&Server] { return Server.Connections == 0; });
+
+	return Server.Failed;
+}
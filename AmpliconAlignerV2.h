@@ -1,47 +1,286 @@
-/*
-* Filename : AmpliconAlignerV2.h
-* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
-* Contact : mlyon@live.co.uk
-* Description : Globally aligns paired-end reads to amplicon sequences and outputs in SAM format.
-* Status: Release
-*/
-
-#include <string>
-#include <seqan/Align.h>
-
-using namespace std;
-
-typedef struct {
-	string ID;
-	string Chrom;
-	string RefSeq;
-	unsigned Pos;
-	string LeftPrimer;
-	string RightPrimer;
-	unsigned LeftPrimerLen;
-	unsigned RightPrimerLen;
-	bool Strand; //is+Strand
-} AmpliconRecord;
-
-typedef struct {
-	unsigned Usable;
-	unsigned Merged;
-	unsigned Mapped;
-} Stat;
-
-typedef seqan::String<char> TSequence;                 // sequence type
-typedef seqan::Align<TSequence, seqan::ArrayGaps> TAlign;      // align type
-typedef seqan::Row<TAlign>::Type TRow;
-typedef seqan::Iterator<TRow>::Type TRowIterator;
-
-string GetFlowCellID(const string& header);
-bool MatchPrimer(const string& Seq, const string& Primer);
-string GetFlowCellID(const string& header);
-void RightPrimerClipper(string& Seq, string& Qual, string Primer);
-string ReverseComplement(const string& DNA);
-bool ReadMerger(const string& SeqR1, const string& QualR1, string SeqR2, string QualR2,
-	const unsigned MaxQScore, const unsigned QScorePhredOffset, pair<string, string>& MergedRead);
-bool GetAmplicons(ifstream& Amplicons_in, vector<AmpliconRecord>& AmpliconRecords, vector<string>& SamHeaders);
-bool isStringDNA(const string& str);
-bool getCigarNM(TRow& row1, TRow& row2, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted, pair<string, unsigned>& CigarNM, unsigned& SingleBaseMisMatchFrequency);
-bool isReadNMasked(const string& read);
+/*
+* Filename : AmpliconAlignerV2.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Globally aligns paired-end reads to amplicon sequences and outputs in SAM format.
+* Status: Release
+*/
+
+#ifndef AMPLICONALIGNERV2_H
+#define AMPLICONALIGNERV2_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include "StageTiming.h"
+#include "PackedSequence.h"
+
+using namespace std;
+
+const unsigned ClipProfileMaxPrimerLen = 240; //local alignment scores are held in bytes
+
+typedef struct {
+	string Primer;
+	unsigned Segments; //primer base j is in lane j / Segments of segment j % Segments
+	vector<uint8_t> Scores; //Segments x 16 biased match/mismatch scores for each read base A C G T and other
+} ClipProfile;
+
+const unsigned AlignmentProfilePad = 256; //pad bases either side of the reference; wider bands pad a copy per read
+const unsigned MaxAlignmentLength = 9000; //query + reference; keeps BandedGlobalAlignment's 16-bit scores clear of overflow
+const unsigned MaxAmpliconLength = MaxAlignmentLength / 2; //leaves room for a merged read as long as the amplicon
+
+typedef struct {
+	vector<char> RefPad; //strand converted reference padded for BandedGlobalAlignment
+	unsigned RefLen;
+	unsigned LeftPrimerLen; //strand converted primer lengths
+	unsigned RightPrimerLen;
+} AlignmentProfile; //built by GetAmplicons; read only and shared by all threads
+
+typedef struct {
+	string ID;
+	string Chrom;
+	string RefSeq;
+	unsigned Pos;
+	string LeftPrimer;
+	string RightPrimer;
+	PackedSequence LeftPrimerPacked;
+	PackedSequence RightPrimerPacked;
+	vector<uint64_t> KmerFilter; //bit table of k-mers on both strands; see isPairOffTarget
+	unsigned LeftPrimerLen;
+	unsigned RightPrimerLen;
+	bool Strand; //is+Strand
+	int RefID; //index of Chrom in the @SQ headers; -1 if absent
+	ClipProfile RightPrimerClip; //clips R1
+	ClipProfile LeftPrimerClip; //clips R2
+	AlignmentProfile Alignment;
+	string SamPrefix; //FLAG RNAME POS of every SAM record, tab delimited
+	string SamSuffix; //trailing CO tag and newline
+} AmpliconRecord;
+
+typedef struct {
+	unsigned Usable;
+	unsigned Merged;
+	unsigned Mapped;
+	unsigned long Alignments; //merged reads aligned, including fast path and cache hits
+	uint64_t AlignmentNanoseconds;
+} Stat;
+
+typedef struct {
+	string_view Header; //read name
+	string_view Seq1;
+	string_view Qual1;
+	string_view Seq2;
+	string_view Qual2;
+} ReadPair; //views into the FASTQ input buffers; clipping shortens the views
+
+enum OutputFormat { SamOutput, BamOutput };
+
+typedef struct {
+	unsigned MinIsize;
+	unsigned MaxQScore;
+	unsigned QScorePhredOffset;
+	float MaxSingleBaseMisMatch; //maximum fraction of mismatching bases relative to the wildtype length
+	unsigned MaxIndel; //alignment band either side of the length difference
+	OutputFormat Format;
+	bool SortOutput; //coordinate-sorted BAM with a .bai index
+	size_t SortMemory; //bytes of BAM records held per sample before spilling to a temp file
+	unsigned Shard; //1-based; aligns batches where batch number % Shards == Shard - 1
+	unsigned Shards; //1 if not sharded
+	unsigned long FirstPair; //1-based inclusive range of read pairs to align
+	unsigned long LastPair;
+} AlignerParameters;
+
+typedef struct {
+	unsigned nMaskedReads;
+	unsigned PrimerMatchedReads;
+	unsigned OffTargetReads; //primer matched but rejected by the k-mer filter
+	unsigned TotalUsableReads;
+	unsigned TotalMappedReads;
+	unsigned TotalNotMergedReads;
+	unsigned AlignmentCacheHits;
+	unsigned AlignmentCacheMisses;
+	StageTiming Timing; //summed over threads
+	vector<Stat> AmpliconStats; //indexed as AmpliconRecords
+} MappingStats;
+
+const unsigned PrimerSeedMaxBases = 31; //bases packed into one 64-bit seed
+
+typedef struct {
+	unsigned PrimerLen;
+	vector<unsigned> BlockStarts; //seed blocks tiling the primer before the exact 3' bases
+	vector<unsigned> BlockLens;
+} PrimerSeedLayout;
+
+typedef struct {
+	vector<PrimerSeedLayout> Layouts; //one per distinct primer length, shortest first
+	uint64_t BucketMask;
+	vector<unsigned> Buckets; //offsets into SeedKeys/SeedAmplicons; bucket = key & BucketMask
+	vector<uint64_t> SeedKeys;
+	vector<unsigned> SeedAmplicons;
+	vector<unsigned> Unindexed; //amplicons with primers too short to seed; checked on every read
+} PrimerIndex;
+
+typedef struct {
+	vector<AmpliconRecord> AmpliconRecords;
+	vector<string> SamHeaders;
+	vector<pair<string, unsigned>> References; //@SQ names and lengths for BAM output
+	PrimerIndex LeftPrimerIndex;
+} AmpliconPanel; //loaded once and shared by all samples
+
+typedef struct {
+	string Prefix; //output filename prefix and sample name
+	string R1FASTQ;
+	string R2FASTQ; //empty if R1 and R2 records alternate in R1FASTQ
+} SampleFiles;
+
+enum CigarOperation { CigarMatch = 0, CigarInsertion = 1, CigarDeletion = 2, CigarSoftClip = 4 }; //BAM operation codes
+
+typedef struct {
+	vector<uint32_t> Ops; //length << 4 | CigarOperation, as stored in BAM
+	unsigned NM; //edit distance excluding the primers
+} PackedCigar; //converted to text or BAM only when the record is written
+
+typedef struct {
+	vector<int16_t> Scores; //rolling anti-diagonal score rows
+	vector<uint8_t> Trace;
+	vector<char> RefPad;
+	vector<char> QueryPad;
+} AlignmentScratch; //reused between alignments on one thread
+
+enum PairOutcome { PairMapped, PairNMasked, PairNoPrimerMatch, PairOffTarget, PairPrimerDimer, PairNotMerged, PairNotAligned, PairMismatched };
+
+typedef struct {
+	PairOutcome Outcome; //reason the pair was not mapped
+	int Amplicon; //index into AmpliconRecords; -1 if no primer pair matched
+	bool Strand; //amplicon strand; is+Strand
+	unsigned Pos; //1-based leftmost aligned reference base after primer soft-clipping
+	unsigned MapQ;
+	int AS; //global alignment score
+	PackedCigar Cigar; //primers soft clipped
+	pair<string, string> MergedRead; //seq and qual on the + strand
+} PairAlignment; //fields after the rejecting step are not set
+
+typedef struct {
+	AlignmentScratch Alignment;
+	pair<string, string> ReverseR2; //R2 seq and qual in R1 orientation
+	PairAlignment Result; //merged read and CIGAR when formatting straight to output
+	PackedSequence PackedR1; //unclipped reads; clipping keeps a prefix so the packed bases stay valid
+	PackedSequence PackedR2;
+} ReadPairScratch; //per-thread buffers for one read pair; no allocation once grown to the longest read
+
+const unsigned AlignmentCacheSlots = 256; //per amplicon
+
+typedef struct {
+	bool Filled;
+	size_t Hash;
+	string Seq; //merged read on the + strand
+	bool Aligned; //false if the alignment or CIGAR was rejected
+	int NWScore;
+	PackedCigar Cigar;
+	unsigned SingleBaseMisMatchFrequency;
+} AlignmentCacheEntry;
+
+typedef struct {
+	mutex Lock;
+	vector<AlignmentCacheEntry> Slots; //direct mapped by sequence hash; allocated on first insert
+} AlignmentCache; //results for one amplicon shared by all worker threads
+
+typedef struct {
+	unsigned long FirstPair; //0-based pair number in the input
+	unsigned long Pairs;
+	uint64_t Bytes; //uncompressed SAM/BAM records written for the pairs
+} ShardBatch;
+
+typedef struct {
+	string ReadGroup;
+	string CommandLine;
+	float Version;
+	OutputFormat Format;
+	uint64_t HeaderBytes; //uncompressed header ahead of the records
+	unsigned Threads;
+	double WallSeconds;
+	bool InputEnded; //InputPairs is only known if the shard read to the end of the FASTQs
+	unsigned long InputPairs;
+	unsigned TotalReads; //pairs aligned by the shard
+	MappingStats Totals;
+	vector<string> AmpliconIDs; //indexed as Totals.AmpliconStats
+	vector<ShardBatch> Batches; //in output order
+} ShardStats; //partial results of one shard, merged by MergeShards, or of one batch aligned by the server
+
+const uint32_t SocketFrameMaxBytes = 1 << 30; //largest frame payload exchanged with the alignment server
+
+class ReadPairPipeline;
+class AlignerEngine;
+
+
+string GetFlowCellID(const string& header);
+bool MatchPrimer(const PackedSequence& Seq, const PackedSequence& Primer);
+string GetFlowCellID(const string& header);
+void RightPrimerClipper(string_view& Seq, string_view& Qual, const ClipProfile& Primer);
+bool BuildClipProfile(const string& Primer, ClipProfile& Profile);
+string ReverseComplement(const string& DNA);
+void ReverseComplement(string_view DNA, string& RevComp);
+bool ReadMerger(string_view SeqR1, string_view QualR1, string_view SeqR2, string_view QualR2, const PackedSequence& PackedR1, const PackedSequence& PackedR2,
+	const unsigned MaxQScore, const unsigned QScorePhredOffset, pair<string, string>& ReverseR2, pair<string, string>& MergedRead);
+bool GetAmplicons(ifstream& Amplicons_in, vector<AmpliconRecord>& AmpliconRecords, vector<string>& SamHeaders, PrimerIndex& LeftPrimerIndex);
+bool isStringDNA(const string& str);
+bool getCigarNM(const string& Ref, const string& Query, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted,
+	PackedCigar& Cigar, unsigned& SingleBaseMisMatchFrequency);
+void AppendCigar(string& Out, const vector<uint32_t>& Ops);
+void BuildSamFields(AmpliconRecord& Amplicon);
+void AppendSamHeader(string& Out, const vector<string>& SamHeaders, const string& ReadGroup, const string& Sample, const string& CommandLine, const float Version);
+void AppendSamRecord(string& Out, string_view ReadName, const AmpliconRecord& Amplicon, const unsigned MapQ, const vector<uint32_t>& Cigar,
+	const string& Seq, const string& Qual, const string& ReadGroup, const unsigned NM, const int AS);
+bool isReadNMasked(string_view read);
+void AppendNumber(string& Out, long Value);
+bool BuildPrimerIndex(const vector<AmpliconRecord>& AmpliconRecords, PrimerIndex& Index);
+bool PrimerSeedKey(const PackedSequence& Seq, const PrimerSeedLayout& Layout, const unsigned Block, uint64_t& Key);
+int MatchAmplicon(const PackedSequence& Seq, const vector<AmpliconRecord>& AmpliconRecords, const PrimerIndex& Index);
+void BuildKmerFilter(const string& RefSeq, vector<uint64_t>& Filter);
+bool isPairOffTarget(const PackedSequence& R1, const PackedSequence& R2, const AmpliconRecord& Amplicon);
+bool UngappedAlignment(const string& Ref, const string& Query, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted,
+	int& NWScore, PackedCigar& Cigar, unsigned& SingleBaseMisMatchFrequency);
+unsigned CountMismatches(const char* Ref, const char* Query, size_t Len);
+bool BandedGlobalAlignment(const AlignmentProfile& Profile, const string& Query, const unsigned MaxIndel, AlignmentScratch& Scratch,
+	int& NWScore, PackedCigar& Cigar);
+void BuildAlignmentProfile(const string& RefSeq, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted, AlignmentProfile& Profile);
+unsigned BamReg2Bin(int Beg, int End);
+bool GetSamReferences(const vector<string>& SamHeaders, vector<pair<string, unsigned>>& References);
+void AppendBamHeader(string& Out, const string& HeaderText, const vector<pair<string, unsigned>>& References);
+void AppendBamRecord(string& Out, string_view ReadName, const unsigned Flag, const int RefID, const unsigned Pos, const unsigned MapQ,
+	const vector<uint32_t>& Cigar, const string& Seq, const string& Qual, const unsigned QScorePhredOffset,
+	const string& ReadGroup, const unsigned NM, const int AS, const string& Comment);
+bool FindCachedAlignment(AlignmentCache& Cache, const string& Seq, bool& Aligned, int& NWScore, PackedCigar& Cigar, unsigned& SingleBaseMisMatchFrequency);
+void CacheAlignment(AlignmentCache& Cache, const string& Seq, const bool Aligned, const int NWScore, const PackedCigar& Cigar, const unsigned SingleBaseMisMatchFrequency);
+bool WriteStageTiming(const string& Filename, const MappingStats& Totals, const vector<string>& AmpliconIDs, const unsigned Threads, const double WallSeconds);
+void AddMappingStats(MappingStats& Totals, const MappingStats& Stats);
+bool WriteMappingStats(const string& Filename, const string& ReadGroup, const string& CommandLine, const float Version, const unsigned TotalReads,
+	const MappingStats& Totals, const vector<string>& AmpliconIDs);
+bool WriteShardStats(ostream& Shard_out, const ShardStats& Shard);
+bool WriteShardStats(const string& Filename, const ShardStats& Shard);
+bool ReadShardStats(istream& Shard_in, const string& Filename, ShardStats& Shard);
+bool ReadShardStats(const string& Filename, ShardStats& Shard);
+bool MergeShards(const string& Prefix, const vector<string>& ShardPrefixes, const AlignerParameters& Parameters, const unsigned Threads, const float Version);
+bool GetSampleManifest(ifstream& Manifest_in, vector<SampleFiles>& Samples);
+bool WriteCompiledPanel(const string& Filename, const string& AmpliconFilename, const AmpliconPanel& Panel);
+bool isCompiledPanel(const string& Filename);
+bool ReadCompiledPanel(const string& Filename, AmpliconPanel& Panel);
+bool AlignSample(const SampleFiles& Sample, const AmpliconPanel& Panel, const AlignerParameters& Parameters, const string& CommandLine, const float Version,
+	const unsigned Threads, ReadPairPipeline& Pipeline);
+int ConnectSocket(const string& SocketPath);
+bool WriteFrame(int Socket, const string& Tag, const string& Payload);
+bool ReadFrame(int Socket, string& Tag, string& Payload);
+bool RunAlignmentServer(const string& SocketPath, AlignerEngine& Engine, const string& CommandLine, const float Version, const unsigned Threads);
+bool RunAlignmentClient(const string& SocketPath, const SampleFiles& Sample);
+bool StopAlignmentServer(const string& SocketPath);
+void AlignReadPair(ReadPair& Pair, const vector<AmpliconRecord>& AmpliconRecords, const PrimerIndex& LeftPrimerIndex, const AlignerParameters& Parameters,
+	ReadPairScratch& Scratch, vector<AlignmentCache>& AlignmentCaches, PairAlignment& Result, MappingStats& Stats);
+void AlignReadPair(ReadPair& Pair, const vector<AmpliconRecord>& AmpliconRecords, const PrimerIndex& LeftPrimerIndex, const AlignerParameters& Parameters,
+	const string& ReadGroup, ReadPairScratch& Scratch, vector<AlignmentCache>& AlignmentCaches, string& SamRecords, MappingStats& Stats);
+void AppendPairRecord(string& SamRecords, const ReadPair& Pair, const PairAlignment& Result, const vector<AmpliconRecord>& AmpliconRecords,
+	const AlignerParameters& Parameters, const string& ReadGroup);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+/*
+* Filename : AppendNumber.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Appends the decimal text of an integer to a string without a temporary string.
+* Status: Release
+*/
+
+#include <string>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+static const char DigitPairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+void AppendNumber(string& Out, long Value) { //same text as to_string
+
+	char Digits[24];
+	char* Begin = Digits + sizeof(Digits);
+	unsigned long Magnitude = Value < 0 ? 0UL - (unsigned long) Value : (unsigned long) Value;
+
+	//two digits per division, written backwards
+	while (Magnitude >= 100) {
+		unsigned Pair = Magnitude % 100 * 2;
+		Magnitude /= 100;
+		*--Begin = DigitPairs[Pair + 1];
+		*--Begin = DigitPairs[Pair];
+	}
+
+	if (Magnitude >= 10) {
+		*--Begin = DigitPairs[Magnitude * 2 + 1];
+		*--Begin = DigitPairs[Magnitude * 2];
+	} else {
+		*--Begin = '0' + Magnitude;
+	}
+
+	if (Value < 0) {
+		*--Begin = '-';
+	}
+
+	Out.append(Begin, Digits + sizeof(Digits) - Begin); //one append
+
+}
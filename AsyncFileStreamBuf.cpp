@@ -0,0 +1,132 @@
+/*
+* Filename : AsyncFileStreamBuf.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Output stream buffer handing large buffers to a writer thread so slow storage does not stall the caller.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "AsyncFileStreamBuf.h"
+
+using namespace std;
+
+/*									Method
+Buffers circulate between two queues: the caller fills one and queues it for the writer thread, then takes a free one;
+the writer returns each buffer to the free queue once written. With two buffers the caller fills one while the other is
+written, and only waits if storage is slower than it produces output; that wait is reported as the output_stall stage.
+*/
+
+AsyncFileStreamBuf::AsyncFileStreamBuf(const string& Filename, size_t BufferSize, unsigned Buffers) :
+	File(fopen(Filename.c_str(), "wb")), Current(BufferSize), FullQueue(Buffers < 2 ? 2 : Buffers), FreeQueue(Buffers < 2 ? 2 : Buffers),
+	StallNanoseconds(0), Submitted(0), Failed(false), Closed(false) {
+
+	for (unsigned b = 1; b < (Buffers < 2 ? 2 : Buffers); ++b) {
+		FreeQueue.Push(vector<char>(BufferSize));
+	}
+
+	setp(&Current[0], &Current[0] + Current.size());
+
+	if (File != NULL) {
+		WriterThread = thread(&AsyncFileStreamBuf::Writer, this);
+	}
+
+}
+
+AsyncFileStreamBuf::~AsyncFileStreamBuf() {
+	close();
+}
+
+int AsyncFileStreamBuf::overflow(int c) {
+
+	if (Closed || File == NULL) {
+		return traits_type::eof();
+	}
+
+	Submit(false);
+
+	if (c != traits_type::eof()) {
+		*pptr() = (char) c;
+		pbump(1);
+	}
+
+	return Failed ? traits_type::eof() : traits_type::not_eof(c);
+}
+
+int AsyncFileStreamBuf::sync() {
+
+	if (!Closed && File != NULL && pptr() > pbase()) {
+		Submit(false);
+	}
+
+	return Failed ? -1 : 0;
+}
+
+void AsyncFileStreamBuf::Submit(bool Last) {
+
+	uint64_t Start = StageClock();
+	size_t Used = pptr() - pbase();
+
+	if (Used > 0) {
+		FullQueue.Push(TBuffer(std::move(Current), Used));
+		Submitted++;
+	}
+
+	if (Last) {
+		setp(NULL, NULL);
+		return;
+	}
+
+	if (Used > 0 && FreeQueue.Pop(Current) == false) {
+		Failed = true;
+	}
+
+	StallNanoseconds += StageClock() - Start; //waiting for the writer to free a buffer
+
+	setp(&Current[0], &Current[0] + Current.size());
+}
+
+void AsyncFileStreamBuf::Writer() {
+
+	TBuffer Full;
+
+	while (FullQueue.Pop(Full)) {
+
+		if (!Failed && fwrite(Full.first.data(), 1, Full.second, File) != Full.second) {
+			Failed = true;
+		}
+
+		FreeQueue.Push(std::move(Full.first));
+	}
+
+}
+
+void AsyncFileStreamBuf::AddStallTiming(StageTiming& Timing) const {
+	Timing.Nanoseconds[StageOutputStall] += StallNanoseconds;
+	Timing.Calls[StageOutputStall] += Submitted;
+}
+
+bool AsyncFileStreamBuf::close() {
+
+	if (Closed) {
+		return !Failed;
+	} else if (File == NULL) {
+		return false;
+	}
+
+	Submit(true);
+	Closed = true;
+
+	FullQueue.Close();
+	WriterThread.join();
+
+	if (fclose(File) != 0) {
+		Failed = true;
+	}
+
+	File = NULL;
+
+	return !Failed;
+}
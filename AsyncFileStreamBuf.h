@@ -0,0 +1,57 @@
+/*
+* Filename : AsyncFileStreamBuf.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Output stream buffer handing large buffers to a writer thread so slow storage does not stall the caller.
+* Status: Release
+*/
+
+#ifndef ASYNCFILESTREAMBUF_H
+#define ASYNCFILESTREAMBUF_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <streambuf>
+#include <thread>
+#include <atomic>
+#include "BoundedQueue.h"
+#include "StageTiming.h"
+
+using namespace std;
+
+const size_t AsyncFileBufferSize = 4 << 20; //bytes per write
+
+class AsyncFileStreamBuf : public streambuf {
+public:
+	//one buffer is filled while the others are written; double buffered by default
+	AsyncFileStreamBuf(const string& Filename, size_t BufferSize = AsyncFileBufferSize, unsigned Buffers = 2);
+	~AsyncFileStreamBuf();
+
+	bool is_open() const { return File != NULL; }
+	bool close(); //writes the remaining data and waits for the writer; false on error
+	void AddStallTiming(StageTiming& Timing) const; //time spent waiting for a free buffer; valid after close
+
+protected:
+	int overflow(int c);
+	int sync();
+
+private:
+	typedef pair<vector<char>, size_t> TBuffer; //buffer and bytes used
+
+	void Submit(bool Last); //hands the current buffer to the writer and takes a free one unless Last
+	void Writer();
+
+	FILE* File;
+	vector<char> Current;
+	BoundedQueue<TBuffer> FullQueue;
+	BoundedQueue<vector<char>> FreeQueue;
+	thread WriterThread;
+	uint64_t StallNanoseconds;
+	unsigned long Submitted;
+	atomic<bool> Failed;
+	bool Closed;
+};
+
+#endif
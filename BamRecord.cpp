@@ -0,0 +1,195 @@
+/*
+* Filename : BamRecord.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Encodes the SAM header and alignment records in BAM binary format.
+* Status: Release
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+static void AppendLE(string& Out, uint32_t Value, unsigned Bytes) {
+	for (unsigned b = 0; b < Bytes; ++b) {
+		Out += (char) ((Value >> (8 * b)) & 0xff);
+	}
+}
+
+static void SetLE(string& Out, size_t Offset, uint32_t Value) {
+	for (unsigned b = 0; b < 4; ++b) {
+		Out[Offset + b] = (char) ((Value >> (8 * b)) & 0xff);
+	}
+}
+
+//smallest integer type as chosen by samtools
+static void AppendIntegerTag(string& Out, const char* Tag, int64_t Value) {
+
+	Out += Tag[0];
+	Out += Tag[1];
+
+	if (Value >= 0) {
+		if (Value <= 0xff) {
+			Out += 'C';
+			AppendLE(Out, Value, 1);
+		} else if (Value <= 0xffff) {
+			Out += 'S';
+			AppendLE(Out, Value, 2);
+		} else {
+			Out += 'I';
+			AppendLE(Out, Value, 4);
+		}
+	} else {
+		if (Value >= -128) {
+			Out += 'c';
+			AppendLE(Out, (uint32_t) Value, 1);
+		} else if (Value >= -32768) {
+			Out += 's';
+			AppendLE(Out, (uint32_t) Value, 2);
+		} else {
+			Out += 'i';
+			AppendLE(Out, (uint32_t) Value, 4);
+		}
+	}
+
+}
+
+static void AppendStringTag(string& Out, const char* Tag, const string& Value) {
+	Out += Tag[0];
+	Out += Tag[1];
+	Out += 'Z';
+	Out += Value;
+	Out += '\0';
+}
+
+unsigned BamReg2Bin(int Beg, int End) { //SAM specification 5.3; End is exclusive
+
+	--End;
+
+	if (Beg >> 14 == End >> 14) return ((1 << 15) - 1) / 7 + (Beg >> 14);
+	if (Beg >> 17 == End >> 17) return ((1 << 12) - 1) / 7 + (Beg >> 17);
+	if (Beg >> 20 == End >> 20) return ((1 << 9) - 1) / 7 + (Beg >> 20);
+	if (Beg >> 23 == End >> 23) return ((1 << 6) - 1) / 7 + (Beg >> 23);
+	if (Beg >> 26 == End >> 26) return ((1 << 3) - 1) / 7 + (Beg >> 26);
+
+	return 0;
+}
+
+bool GetSamReferences(const vector<string>& SamHeaders, vector<pair<string, unsigned>>& References) { //@SQ SN and LN in header order
+
+	References.clear();
+
+	for (unsigned n = 0; n < SamHeaders.size(); ++n) {
+
+		if (SamHeaders[n].compare(0, 4, "@SQ\t") != 0) {
+			continue;
+		}
+
+		string Name;
+		long Length = -1;
+		size_t Start = 4, End;
+
+		do {
+			End = SamHeaders[n].find('\t', Start);
+			string Field = SamHeaders[n].substr(Start, End == string::npos ? string::npos : End - Start);
+
+			if (Field.compare(0, 3, "SN:") == 0) {
+				Name = Field.substr(3);
+			} else if (Field.compare(0, 3, "LN:") == 0) {
+				Length = strtol(Field.c_str() + 3, NULL, 10);
+			}
+
+			Start = End + 1;
+		} while (End != string::npos);
+
+		if (Name == "" || Length < 0) {
+			return 1;
+		}
+
+		References.push_back(make_pair(Name, (unsigned) Length));
+	}
+
+	return 0;
+}
+
+void AppendBamHeader(string& Out, const string& HeaderText, const vector<pair<string, unsigned>>& References) {
+
+	Out += "BAM\1";
+	AppendLE(Out, HeaderText.size(), 4);
+	Out += HeaderText;
+	AppendLE(Out, References.size(), 4);
+
+	for (unsigned n = 0; n < References.size(); ++n) {
+		AppendLE(Out, References[n].first.size() + 1, 4);
+		Out += References[n].first;
+		Out += '\0';
+		AppendLE(Out, References[n].second, 4);
+	}
+
+}
+
+void AppendBamRecord(string& Out, string_view ReadName, const unsigned Flag, const int RefID, const unsigned Pos, const unsigned MapQ,
+	const vector<uint32_t>& Cigar, const string& Seq, const string& Qual, const unsigned QScorePhredOffset,
+	const string& ReadGroup, const unsigned NM, const int AS, const string& Comment) {
+
+	static const char SeqCodes[] = "=ACMGRSVTWYHKDBN";
+	size_t Start = Out.size(), c;
+	unsigned RefLen = 0;
+
+	AppendLE(Out, 0, 4); //block_size; set below
+	AppendLE(Out, RefID, 4);
+	AppendLE(Out, Pos - 1, 4); //0-based
+	AppendLE(Out, ReadName.size() + 1, 1);
+	AppendLE(Out, MapQ, 1);
+	AppendLE(Out, 0, 2); //bin; set once the reference length is known
+	AppendLE(Out, 0, 2); //n_cigar_op; set below
+	AppendLE(Out, Flag, 2);
+	AppendLE(Out, Seq.size(), 4);
+	AppendLE(Out, (uint32_t) -1, 4); //next refID
+	AppendLE(Out, (uint32_t) -1, 4); //next pos
+	AppendLE(Out, 0, 4); //template length
+	Out += ReadName;
+	Out += '\0';
+
+	//packed cigar as built by the aligner; M and D consume the reference
+	for (c = 0; c < Cigar.size(); ++c) {
+		if ((Cigar[c] & 0xf) == CigarMatch || (Cigar[c] & 0xf) == CigarDeletion) {
+			RefLen += Cigar[c] >> 4;
+		}
+		AppendLE(Out, Cigar[c], 4);
+	}
+
+	//4-bit sequence
+	for (c = 0; c < Seq.size(); c += 2) {
+		const char* Base1 = strchr(SeqCodes, Seq[c]);
+		uint8_t Packed = (Base1 == NULL || Seq[c] == '\0' ? 15 : Base1 - SeqCodes) << 4;
+
+		if (c + 1 < Seq.size()) {
+			const char* Base2 = strchr(SeqCodes, Seq[c + 1]);
+			Packed |= Base2 == NULL || Seq[c + 1] == '\0' ? 15 : Base2 - SeqCodes;
+		}
+
+		Out += (char) Packed;
+	}
+
+	for (c = 0; c < Qual.size(); ++c) {
+		Out += (char) (Qual[c] - QScorePhredOffset);
+	}
+
+	AppendStringTag(Out, "RG", ReadGroup);
+	AppendIntegerTag(Out, "NM", NM);
+	AppendIntegerTag(Out, "AS", AS);
+	AppendStringTag(Out, "CO", Comment);
+
+	SetLE(Out, Start, Out.size() - Start - 4);
+	Out[Start + 14] = (char) (BamReg2Bin(Pos - 1, Pos - 1 + (RefLen > 0 ? RefLen : 1)) & 0xff);
+	Out[Start + 15] = (char) (BamReg2Bin(Pos - 1, Pos - 1 + (RefLen > 0 ? RefLen : 1)) >> 8);
+	Out[Start + 16] = (char) (Cigar.size() & 0xff);
+	Out[Start + 17] = (char) (Cigar.size() >> 8);
+}
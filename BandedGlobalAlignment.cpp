@@ -0,0 +1,310 @@
+/*
+* Filename : BandedGlobalAlignment.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Banded affine gap Needleman-Wunsch alignment vectorised along anti-diagonals.
+* Status: Release
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+Cells are addressed by anti-diagonal r = i + j and diagonal k = j - i. Only diagonals kLo..kHi are computed; on each
+anti-diagonal the cells of matching parity are packed into consecutive slots, so a cell's diagonal, horizontal and
+vertical predecessors are the same or neighbouring slots of the previous two anti-diagonals and eight cells are
+scored per SSE4.1 instruction. Scores match seqan::Score<int, Simple>(1, -3, -1, -8): a gap of length l costs 8 + (l - 1).
+Traceback prefers match/mismatch, then deletion, then insertion, and gap extension over re-opening. It walks from the
+end, so CIGAR operations are packed as found and reversed once; mismatches are counted on the way for getCigarNM.
+*/
+
+static const int16_t MatchScore = 1, MismatchScore = -3, GapOpenScore = -8, GapExtendScore = -1;
+static const int16_t NegInf = -30000;
+static const unsigned Lanes = 8, SlotPad = 8;
+static const char RefPadBase = '\001', QueryPadBase = '\002';
+
+enum { TraceDiagonal = 0, TraceDeletion = 1, TraceInsertion = 2, TraceDeletionExtend = 4, TraceInsertionExtend = 8 };
+
+static inline int FloorHalf(int x) {
+	return x >= 0 ? x / 2 : -((1 - x) / 2);
+}
+
+static inline int Parity(int x) {
+	return x & 1; //two's complement; correct for negative values
+}
+
+//best possible score of a path that leaves diagonals kLo..kHi; such a path needs at least two gaps
+static int OutsideBandBound(const int n, const int m, const int kLo, const int kHi) {
+
+	int Bound = NegInf, GapBases;
+
+	if (kHi < m) {
+		GapBases = 2 * (kHi + 1) - (m - n);
+		Bound = max(Bound, (n + m - GapBases) / 2 * MatchScore + 2 * GapOpenScore + (GapBases - 2) * GapExtendScore);
+	}
+	if (kLo > -n) {
+		GapBases = 2 * (1 - kLo) + (m - n);
+		Bound = max(Bound, (n + m - GapBases) / 2 * MatchScore + 2 * GapOpenScore + (GapBases - 2) * GapExtendScore);
+	}
+
+	return Bound;
+}
+
+//fills one anti-diagonal; Slots is a multiple of Lanes
+static void ScoreAntiDiagonal(const int16_t* Hm2, const int16_t* Hm1, const int16_t* Em1, const int16_t* Fm1,
+	int16_t* H, int16_t* E, int16_t* F, uint8_t* Trace, const char* Ref, const char* Query, const int EOffset, const int FOffset, const int Slots) {
+
+	int s = 0;
+
+#ifdef __SSE4_1__
+	const __m128i Match = _mm_set1_epi16(MatchScore), Mismatch = _mm_set1_epi16(MismatchScore);
+	const __m128i Open = _mm_set1_epi16(GapOpenScore), Extend = _mm_set1_epi16(GapExtendScore);
+	const __m128i One = _mm_set1_epi16(1), Two = _mm_set1_epi16(2), Four = _mm_set1_epi16(TraceDeletionExtend), Eight = _mm_set1_epi16(TraceInsertionExtend);
+
+	for (; s + (int) Lanes <= Slots; s += Lanes) {
+
+		__m128i Same = _mm_cvtepi8_epi16(_mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*) (Ref + s)), _mm_loadl_epi64((const __m128i*) (Query + s))));
+		__m128i D = _mm_adds_epi16(_mm_loadu_si128((const __m128i*) (Hm2 + s)), _mm_blendv_epi8(Mismatch, Match, Same));
+
+		__m128i EOpen = _mm_adds_epi16(_mm_loadu_si128((const __m128i*) (Hm1 + s + EOffset)), Open);
+		__m128i EExt = _mm_adds_epi16(_mm_loadu_si128((const __m128i*) (Em1 + s + EOffset)), Extend);
+		__m128i FOpen = _mm_adds_epi16(_mm_loadu_si128((const __m128i*) (Hm1 + s + FOffset)), Open);
+		__m128i FExt = _mm_adds_epi16(_mm_loadu_si128((const __m128i*) (Fm1 + s + FOffset)), Extend);
+
+		__m128i EVal = _mm_max_epi16(EOpen, EExt), FVal = _mm_max_epi16(FOpen, FExt);
+		__m128i FromE = _mm_cmpgt_epi16(EVal, D);
+		__m128i HVal = _mm_max_epi16(D, EVal);
+		__m128i FromF = _mm_cmpgt_epi16(FVal, HVal);
+		HVal = _mm_max_epi16(HVal, FVal);
+
+		__m128i Bits = _mm_blendv_epi8(_mm_and_si128(FromE, One), Two, FromF);
+		Bits = _mm_or_si128(Bits, _mm_andnot_si128(_mm_cmpgt_epi16(EOpen, EExt), Four));
+		Bits = _mm_or_si128(Bits, _mm_andnot_si128(_mm_cmpgt_epi16(FOpen, FExt), Eight));
+
+		_mm_storeu_si128((__m128i*) (H + s), HVal);
+		_mm_storeu_si128((__m128i*) (E + s), EVal);
+		_mm_storeu_si128((__m128i*) (F + s), FVal);
+		_mm_storel_epi64((__m128i*) (Trace + s), _mm_packus_epi16(Bits, Bits));
+	}
+#endif
+
+	for (; s < Slots; ++s) {
+
+		int D = Hm2[s] + (Ref[s] == Query[s] ? MatchScore : MismatchScore);
+		int EOpen = Hm1[s + EOffset] + GapOpenScore, EExt = Em1[s + EOffset] + GapExtendScore;
+		int FOpen = Hm1[s + FOffset] + GapOpenScore, FExt = Fm1[s + FOffset] + GapExtendScore;
+		int EVal = max(EOpen, EExt), FVal = max(FOpen, FExt), HVal = D;
+		uint8_t Bits = TraceDiagonal;
+
+		if (EVal > HVal) {
+			HVal = EVal;
+			Bits = TraceDeletion;
+		}
+		if (FVal > HVal) {
+			HVal = FVal;
+			Bits = TraceInsertion;
+		}
+		if (EExt >= EOpen) {
+			Bits |= TraceDeletionExtend;
+		}
+		if (FExt >= FOpen) {
+			Bits |= TraceInsertionExtend;
+		}
+
+		//saturate as the vector path does
+		H[s] = max(HVal, -32768);
+		E[s] = max(EVal, -32768);
+		F[s] = max(FVal, -32768);
+		Trace[s] = Bits;
+	}
+
+}
+
+//returns 1 if no alignment within the band can score MinScore or more
+static bool AlignBand(const AlignmentProfile& Profile, string_view Ref, const string& Query, const int kLo, const int kHi, const int MinScore,
+	AlignmentScratch& Scratch, int& NWScore, PackedCigar& Cigar) {
+
+	const int n = Query.length(), m = Ref.length();
+	const unsigned Slots = ((kHi - kLo + 2) / 2 + Lanes - 1) / Lanes * Lanes;
+	const unsigned Stride = Slots + 2 * SlotPad, SeqPad = Slots + 2 * Lanes;
+	int r, p, s, sLo, sHi, i, j, k, Best;
+
+	//rolling score rows: H for r, r-1, r-2 then E and F for r and r-1
+	Scratch.Scores.assign(7 * Stride, NegInf);
+	int16_t* Rows[7];
+	for (s = 0; s < 7; ++s) {
+		Rows[s] = &Scratch.Scores[s * Stride + SlotPad];
+	}
+	int16_t *H = Rows[0], *Hm1 = Rows[1], *Hm2 = Rows[2], *E = Rows[3], *Em1 = Rows[4], *F = Rows[5], *Fm1 = Rows[6];
+
+	Scratch.Trace.resize((size_t) (n + m + 1) * Slots);
+
+	//padded reference and reversed query so each slot run reads consecutive bases; the amplicon profile pad covers usual bands
+	const char* RefBases = &Profile.RefPad[AlignmentProfilePad];
+
+	if (SeqPad > AlignmentProfilePad) {
+		Scratch.RefPad.assign(SeqPad, RefPadBase);
+		Scratch.RefPad.insert(Scratch.RefPad.end(), Ref.begin(), Ref.end());
+		Scratch.RefPad.insert(Scratch.RefPad.end(), SeqPad, RefPadBase);
+		RefBases = &Scratch.RefPad[SeqPad];
+	}
+
+	Scratch.QueryPad.assign(SeqPad, QueryPadBase);
+	Scratch.QueryPad.insert(Scratch.QueryPad.end(), Query.rbegin(), Query.rend());
+	Scratch.QueryPad.insert(Scratch.QueryPad.end(), SeqPad, QueryPadBase);
+
+	for (r = 0; r <= n + m; ++r) {
+
+		//slot s holds diagonal k = kLo + p + 2s
+		p = Parity(r - kLo);
+		int IFirst = (r - kLo - p) / 2, JFirst = (r + kLo + p) / 2; //cell (i, j) of slot 0
+
+		ScoreAntiDiagonal(Hm2, Hm1, Em1, Fm1, H, E, F, &Scratch.Trace[(size_t) r * Slots],
+			RefBases + JFirst - 1, &Scratch.QueryPad[SeqPad + n - IFirst], p == 0 ? -1 : 0, p == 0 ? 0 : 1, (int) Slots);
+
+		//clear slots outside the matrix or the band
+		sLo = max(0, max((r - 2 * n - kLo - p) / 2, (-r - kLo - p) / 2));
+		sHi = min(FloorHalf(kHi - kLo - p), min((r - kLo - p) / 2, (2 * m - r - kLo - p) / 2));
+
+		for (s = 0; s < (int) Slots; ++s) {
+			if (s < sLo || s > sHi) {
+				H[s] = E[s] = F[s] = NegInf;
+			}
+		}
+
+		//first row and column
+		if (r <= kHi && r <= m) { //i = 0, j = r
+			s = (r - kLo - p) / 2;
+			H[s] = r == 0 ? 0 : GapOpenScore + (r - 1) * GapExtendScore;
+			E[s] = r == 0 ? NegInf : H[s];
+			F[s] = NegInf;
+			Scratch.Trace[(size_t) r * Slots + s] = TraceDeletion | (r > 1 ? TraceDeletionExtend : 0);
+		}
+		if (r > 0 && -r >= kLo && r <= n) { //i = r, j = 0
+			s = (-r - kLo - p) / 2;
+			H[s] = GapOpenScore + (r - 1) * GapExtendScore;
+			E[s] = NegInf;
+			F[s] = H[s];
+			Scratch.Trace[(size_t) r * Slots + s] = TraceInsertion | (r > 1 ? TraceInsertionExtend : 0);
+		}
+
+		//abandon once no remaining path can reach MinScore; a path visits r or r - 1
+		if ((r & 7) == 7) {
+			Best = NegInf;
+			for (s = 0; s < (int) Slots; ++s) {
+				Best = max(Best, (int) max(H[s], Hm1[s]));
+			}
+			if (Best + (n + m - r + 1) / 2 * MatchScore < MinScore) {
+				return 1;
+			}
+		}
+
+		//rotate rows
+		int16_t* Oldest = Hm2;
+		Hm2 = Hm1;
+		Hm1 = H;
+		H = Oldest;
+		swap(E, Em1);
+		swap(F, Fm1);
+	}
+
+	p = Parity(n + m - kLo);
+	NWScore = Hm1[(m - n - kLo - p) / 2];
+
+	//traceback from the bottom right corner
+	Cigar.Ops.clear();
+	Cigar.NM = 0;
+
+	int State = TraceDiagonal;
+	uint32_t Op;
+	i = n;
+	j = m;
+
+	while (i > 0 || j > 0) {
+
+		r = i + j;
+		k = j - i;
+		p = Parity(r - kLo);
+		uint8_t Bits = Scratch.Trace[(size_t) r * Slots + (k - kLo - p) / 2];
+
+		if (State == TraceDiagonal) {
+			State = Bits & 3;
+		}
+
+		if (State == TraceDiagonal) {
+			Op = CigarMatch;
+			if (Ref[j - 1] != Query[i - 1]) {
+				Cigar.NM++; //mismatches including the primers
+			}
+			i--;
+			j--;
+		} else if (State == TraceDeletion) {
+			Op = CigarDeletion;
+			State = (Bits & TraceDeletionExtend) ? TraceDeletion : TraceDiagonal;
+			j--;
+		} else {
+			Op = CigarInsertion;
+			State = (Bits & TraceInsertionExtend) ? TraceInsertion : TraceDiagonal;
+			i--;
+		}
+
+		//extend the current operation or start a new one
+		if (!Cigar.Ops.empty() && (Cigar.Ops.back() & 0xf) == Op) {
+			Cigar.Ops.back() += 1 << 4;
+		} else {
+			Cigar.Ops.push_back(1 << 4 | Op);
+		}
+
+	}
+
+	reverse(Cigar.Ops.begin(), Cigar.Ops.end());
+
+	return 0;
+}
+
+bool BandedGlobalAlignment(const AlignmentProfile& Profile, const string& Query, const unsigned MaxIndel, AlignmentScratch& Scratch,
+	int& NWScore, PackedCigar& Cigar) {
+
+	string_view Ref(&Profile.RefPad[AlignmentProfilePad], Profile.RefLen);
+	const int n = Query.length(), m = Ref.length(), MinScore = 0; //alignments scoring below zero are discarded
+	int kLo = max(-n, min(0, m - n) - (int) MaxIndel), kHi = min(m, max(0, m - n) + (int) MaxIndel);
+
+	//16-bit scores; GetAmplicons limits the reference, so only an unusually long merged read is left unaligned
+	if ((unsigned) (n + m) > MaxAlignmentLength) {
+		return 1;
+	}
+
+	//banded result stands if it beats every path leaving the band; otherwise align the full matrix
+	if (AlignBand(Profile, Ref, Query, kLo, kHi, MinScore, Scratch, NWScore, Cigar) == 0) {
+		if (NWScore > OutsideBandBound(n, m, kLo, kHi)) {
+			return NWScore < MinScore;
+		}
+	} else if (OutsideBandBound(n, m, kLo, kHi) < MinScore) {
+		return 1;
+	}
+
+	if (AlignBand(Profile, Ref, Query, -n, m, MinScore, Scratch, NWScore, Cigar) == 1) {
+		return 1;
+	}
+
+	return NWScore < MinScore;
+}
+
+void BuildAlignmentProfile(const string& RefSeq, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted, AlignmentProfile& Profile) {
+
+	Profile.RefPad.assign(AlignmentProfilePad, RefPadBase);
+	Profile.RefPad.insert(Profile.RefPad.end(), RefSeq.begin(), RefSeq.end());
+	Profile.RefPad.insert(Profile.RefPad.end(), AlignmentProfilePad, RefPadBase);
+	Profile.RefLen = RefSeq.length();
+	Profile.LeftPrimerLen = LeftPrimerLengthStrandConverted;
+	Profile.RightPrimerLen = RightPrimerLengthStrandConverted;
+}
@@ -0,0 +1,475 @@
+/*
+* Filename : AmpliconAlignerBenchmark.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Times the read processing steps and whole runs on synthetic panels of 10, 500 and 5000 amplicons.
+* Status: Release
+*/
+
+/*
+Build from the repository root with make benchmark.
+
+Usage: AmpliconAlignerBenchmark [--pairs N] [--threads N] [--seed N] [--work-dir DIR] [--check-allocations]
+--check-allocations only aligns the pairs twice and fails if the second pass allocates (make check).
+Nothing is read from the network or outside the work directory (default /tmp); data files are removed afterwards.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "../AmpliconAlignerV2.h"
+#include "../ReadPairPipeline.h"
+#include "../AlignerEngine.h"
+#include "../FastqReader.h"
+#include "SyntheticData.h"
+
+using namespace std;
+
+//heap allocations made by the benchmarked code
+static atomic<unsigned long> Allocations(0);
+
+void* operator new(size_t Size) {
+	Allocations++;
+	if (void* Block = malloc(Size ? Size : 1)) {
+		return Block;
+	}
+	throw bad_alloc();
+}
+
+void operator delete(void* Block) noexcept {
+	free(Block);
+}
+
+void operator delete(void* Block, size_t) noexcept {
+	free(Block);
+}
+
+typedef chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point Start) {
+	return chrono::duration<double>(Clock::now() - Start).count();
+}
+
+static void Report(const string& Name, unsigned long Operations, double Elapsed, unsigned long AllocationCount) {
+	printf("%-22s %12.1f ns/op %14.0f ops/s %10.3f allocs/op\n", Name.c_str(), Elapsed * 1e9 / Operations, Operations / Elapsed, (double) AllocationCount / Operations);
+}
+
+//loads a panel through GetAmplicons from a written amplicon list
+static bool LoadPanel(const string& Filename, vector<AmpliconRecord>& AmpliconRecords, PrimerIndex& LeftPrimerIndex) {
+	ifstream Amplicons_in(Filename);
+	vector<string> SamHeaders;
+	return GetAmplicons(Amplicons_in, AmpliconRecords, SamHeaders, LeftPrimerIndex);
+}
+
+static void DefaultParameters(AlignerParameters& Parameters) {
+	Parameters.MinIsize = 5;
+	Parameters.MaxQScore = 40;
+	Parameters.QScorePhredOffset = 33;
+	Parameters.MaxSingleBaseMisMatch = 0.05;
+	Parameters.MaxIndel = 20;
+	Parameters.Format = SamOutput;
+	Parameters.SortOutput = false;
+	Parameters.SortMemory = 0;
+}
+
+static void MicroBenchmarks(const SyntheticParameters& Synthetic, const string& WorkDir) {
+
+	const unsigned Repeats = 5;
+	vector<SyntheticAmplicon> Amplicons;
+	vector<SyntheticReadPair> Pairs(Synthetic.ReadPairs);
+	vector<AmpliconRecord> AmpliconRecords;
+	vector<int> Matched;
+	PrimerIndex LeftPrimerIndex;
+	AlignerParameters Parameters;
+	ReadPairScratch Scratch;
+	string Panel = WorkDir + "/bench_micro_amplicons.txt", Out;
+	unsigned long Operations, Before, Hits = 0;
+	unsigned r, i, Frequency;
+	Clock::time_point Start;
+
+	SyntheticGenerator Random(Synthetic.Seed);
+	GenerateSyntheticPanel(Synthetic, Random, Amplicons);
+	for (r = 0; r < Pairs.size(); ++r) {
+		GenerateSyntheticReadPair(Synthetic, Amplicons, Random, r, Pairs[r]);
+	}
+
+	if (WriteSyntheticPanel(Panel, Amplicons) == 1 || LoadPanel(Panel, AmpliconRecords, LeftPrimerIndex) == 1) {
+		std::cerr << "ERROR: Could not load synthetic panel" << endl;
+		exit(-1);
+	}
+	remove(Panel.c_str());
+	DefaultParameters(Parameters);
+
+	//amplicon of each pair as the aligner would find it
+	for (r = 0; r < Pairs.size(); ++r) {
+		PackSequence(Pairs[r].Seq1, Scratch.PackedR1);
+		Matched.push_back(MatchAmplicon(Scratch.PackedR1, AmpliconRecords, LeftPrimerIndex));
+	}
+
+	printf("\n%u amplicons, %lu read pairs, %u repeats\n", Synthetic.Amplicons, Synthetic.ReadPairs, Repeats);
+
+	//PackSequence: both reads
+	Operations = 0;
+	Before = Allocations;
+	Start = Clock::now();
+	for (i = 0; i < Repeats; ++i) {
+		for (r = 0; r < Pairs.size(); ++r) {
+			PackSequence(Pairs[r].Seq1, Scratch.PackedR1);
+			PackSequence(Pairs[r].Seq2, Scratch.PackedR2);
+			Hits += Scratch.PackedR1.Exact + Scratch.PackedR2.Exact;
+			Operations += 2;
+		}
+	}
+	Report("PackSequence", Operations, Seconds(Start), Allocations - Before);
+
+	//MatchPrimer: packed R2 against the right primer of its amplicon
+	Operations = 0;
+	Before = Allocations;
+	Start = Clock::now();
+	for (i = 0; i < Repeats; ++i) {
+		for (r = 0; r < Pairs.size(); ++r) {
+			if (Matched[r] >= 0) {
+				PackSequence(Pairs[r].Seq2, Scratch.PackedR2);
+				Hits += MatchPrimer(Scratch.PackedR2, AmpliconRecords[Matched[r]].RightPrimerPacked);
+				Operations++;
+			}
+		}
+	}
+	Report("MatchPrimer", Operations, Seconds(Start), Allocations - Before);
+
+	//RightPrimerClipper: both reads
+	Operations = 0;
+	Before = Allocations;
+	Start = Clock::now();
+	for (i = 0; i < Repeats; ++i) {
+		for (r = 0; r < Pairs.size(); ++r) {
+			if (Matched[r] >= 0) {
+				string_view Seq = Pairs[r].Seq1, Qual = Pairs[r].Qual1;
+				RightPrimerClipper(Seq, Qual, AmpliconRecords[Matched[r]].RightPrimerClip);
+				Seq = Pairs[r].Seq2;
+				Qual = Pairs[r].Qual2;
+				RightPrimerClipper(Seq, Qual, AmpliconRecords[Matched[r]].LeftPrimerClip);
+				Hits += Seq.length();
+				Operations += 2;
+			}
+		}
+	}
+	Report("RightPrimerClipper", Operations, Seconds(Start), Allocations - Before);
+
+	//clipped reads for the merge
+	vector<ReadPair> Clipped;
+	vector<unsigned> ClippedAmplicons;
+	for (r = 0; r < Pairs.size(); ++r) {
+		if (Matched[r] >= 0) {
+			ReadPair Pair = { Pairs[r].Header, Pairs[r].Seq1, Pairs[r].Qual1, Pairs[r].Seq2, Pairs[r].Qual2 };
+			RightPrimerClipper(Pair.Seq1, Pair.Qual1, AmpliconRecords[Matched[r]].RightPrimerClip);
+			RightPrimerClipper(Pair.Seq2, Pair.Qual2, AmpliconRecords[Matched[r]].LeftPrimerClip);
+			Clipped.push_back(Pair);
+			ClippedAmplicons.push_back(Matched[r]);
+		}
+	}
+
+	//ReadMerger; includes packing both reads
+	Operations = 0;
+	Before = Allocations;
+	Start = Clock::now();
+	for (i = 0; i < Repeats; ++i) {
+		for (r = 0; r < Clipped.size(); ++r) {
+			PackSequence(Clipped[r].Seq1, Scratch.PackedR1);
+			PackSequence(Clipped[r].Seq2, Scratch.PackedR2);
+			Hits += ReadMerger(Clipped[r].Seq1, Clipped[r].Qual1, Clipped[r].Seq2, Clipped[r].Qual2, Scratch.PackedR1, Scratch.PackedR2, Parameters.MaxQScore, Parameters.QScorePhredOffset,
+				Scratch.ReverseR2, Scratch.Result.MergedRead);
+			Operations++;
+		}
+	}
+	Report("ReadMerger", Operations, Seconds(Start), Allocations - Before);
+
+	//ReverseComplement of the R2 reads
+	Operations = 0;
+	Before = Allocations;
+	Start = Clock::now();
+	for (i = 0; i < Repeats; ++i) {
+		for (r = 0; r < Pairs.size(); ++r) {
+			ReverseComplement(Pairs[r].Seq2, Scratch.ReverseR2.first);
+			Hits += Scratch.ReverseR2.first.length();
+			Operations++;
+		}
+	}
+	Report("ReverseComplement", Operations, Seconds(Start), Allocations - Before);
+
+	//getCigarNM on traceback operations of merged reads; includes copying the unclipped operations
+	vector<PackedCigar> Traced;
+	vector<string> TracedReads;
+	vector<unsigned> RowAmplicons;
+	for (r = 0; r < Clipped.size(); ++r) {
+		int NWScore;
+		const AmpliconRecord& Amplicon = AmpliconRecords[ClippedAmplicons[r]];
+		PackSequence(Clipped[r].Seq1, Scratch.PackedR1);
+		PackSequence(Clipped[r].Seq2, Scratch.PackedR2);
+		if (ReadMerger(Clipped[r].Seq1, Clipped[r].Qual1, Clipped[r].Seq2, Clipped[r].Qual2, Scratch.PackedR1, Scratch.PackedR2, Parameters.MaxQScore, Parameters.QScorePhredOffset,
+			Scratch.ReverseR2, Scratch.Result.MergedRead) == 1) {
+			if (Amplicon.Strand == false) {
+				ReverseComplement(Scratch.Result.MergedRead.first, Scratch.ReverseR2.first);
+				Scratch.Result.MergedRead.first.swap(Scratch.ReverseR2.first);
+			}
+			if (BandedGlobalAlignment(Amplicon.Alignment, Scratch.Result.MergedRead.first, Parameters.MaxIndel, Scratch.Alignment, NWScore, Scratch.Result.Cigar) == 0) {
+				Traced.push_back(Scratch.Result.Cigar);
+				TracedReads.push_back(Scratch.Result.MergedRead.first);
+				RowAmplicons.push_back(ClippedAmplicons[r]);
+			}
+		}
+	}
+
+	Operations = 0;
+	Before = Allocations;
+	Start = Clock::now();
+	for (i = 0; i < Repeats; ++i) {
+		for (r = 0; r < Traced.size(); ++r) {
+			const AlignmentProfile& Profile = AmpliconRecords[RowAmplicons[r]].Alignment;
+			Scratch.Result.Cigar.Ops = Traced[r].Ops;
+			Scratch.Result.Cigar.NM = Traced[r].NM;
+			Hits += getCigarNM(AmpliconRecords[RowAmplicons[r]].RefSeq, TracedReads[r], Profile.LeftPrimerLen, Profile.RightPrimerLen, Scratch.Result.Cigar, Frequency);
+			Operations++;
+		}
+	}
+	Report("getCigarNM", Operations, Seconds(Start), Allocations - Before);
+
+	//AlignReadPair: one thread, output kept in memory
+	vector<AlignmentCache> AlignmentCaches(AmpliconRecords.size());
+	MappingStats Stats = MappingStats();
+	Stats.AmpliconStats.resize(AmpliconRecords.size(), Stat());
+	string ReadGroup = "Benchmark";
+	Out.reserve(1 << 20);
+
+	Operations = 0;
+	Before = Allocations;
+	Start = Clock::now();
+	for (i = 0; i < Repeats; ++i) {
+		for (r = 0; r < Pairs.size(); ++r) {
+			ReadPair Pair = { Pairs[r].Header, Pairs[r].Seq1, Pairs[r].Qual1, Pairs[r].Seq2, Pairs[r].Qual2 };
+			AlignReadPair(Pair, AmpliconRecords, LeftPrimerIndex, Parameters, ReadGroup, Scratch, AlignmentCaches, Out, Stats);
+			Operations++;
+			if (Out.size() > (1 << 19)) {
+				Out.clear();
+			}
+		}
+	}
+	Report("AlignReadPair", Operations, Seconds(Start), Allocations - Before);
+
+	if (Hits == 0) {
+		printf("(no work done)\n");
+	}
+
+}
+
+//aligns the same pairs twice, with AlignReadPair and as an engine batch as the pipeline does; once warm, neither may allocate
+static bool AllocationCheck(const SyntheticParameters& Synthetic, const string& WorkDir) {
+
+	vector<SyntheticAmplicon> Amplicons;
+	vector<SyntheticReadPair> Pairs(Synthetic.ReadPairs);
+	vector<ReadPair> Batch(Pairs.size());
+	vector<PairAlignment> Results;
+	vector<AmpliconRecord> AmpliconRecords;
+	PrimerIndex LeftPrimerIndex;
+	AlignerParameters Parameters;
+	ReadPairScratch Scratch;
+	MappingStats Stats = MappingStats();
+	string Panel = WorkDir + "/bench_check_amplicons.txt", ReadGroup = "Benchmark", Out;
+	unsigned long Before, SamAllocations = 0, EngineAllocations = 0;
+	unsigned Pass;
+	size_t r;
+
+	SyntheticGenerator Random(Synthetic.Seed);
+	GenerateSyntheticPanel(Synthetic, Random, Amplicons);
+	for (r = 0; r < Pairs.size(); ++r) {
+		GenerateSyntheticReadPair(Synthetic, Amplicons, Random, r, Pairs[r]);
+	}
+
+	DefaultParameters(Parameters);
+	AlignerEngine Engine(Parameters);
+
+	if (WriteSyntheticPanel(Panel, Amplicons) == 1 || LoadPanel(Panel, AmpliconRecords, LeftPrimerIndex) == 1 || Engine.LoadPanel(Panel) == 1) {
+		std::cerr << "ERROR: Could not load synthetic panel" << endl;
+		exit(-1);
+	}
+	remove(Panel.c_str());
+
+	vector<AlignmentCache> AlignmentCaches(AmpliconRecords.size());
+	Stats.AmpliconStats.resize(AmpliconRecords.size(), Stat());
+
+	//the first pass grows buffers and fills the alignment caches
+	for (Pass = 0; Pass < 2; ++Pass) {
+
+		Out.clear();
+		Before = Allocations;
+		for (r = 0; r < Pairs.size(); ++r) {
+			ReadPair Pair = { Pairs[r].Header, Pairs[r].Seq1, Pairs[r].Qual1, Pairs[r].Seq2, Pairs[r].Qual2 };
+			AlignReadPair(Pair, AmpliconRecords, LeftPrimerIndex, Parameters, ReadGroup, Scratch, AlignmentCaches, Out, Stats);
+		}
+		SamAllocations = Allocations - Before;
+
+		//clipping shortens the views, so they are reset for each pass; records are formatted as the pipeline workers do
+		for (r = 0; r < Pairs.size(); ++r) {
+			Batch[r] = { Pairs[r].Header, Pairs[r].Seq1, Pairs[r].Qual1, Pairs[r].Seq2, Pairs[r].Qual2 };
+		}
+		Out.clear();
+		Before = Allocations;
+		Engine.AlignBatch(Batch, Results, Stats);
+		for (r = 0; r < Batch.size(); ++r) {
+			if (Results[r].Outcome == PairMapped) {
+				AppendPairRecord(Out, Batch[r], Results[r], Engine.GetPanel().AmpliconRecords, Parameters, ReadGroup);
+			}
+		}
+		EngineAllocations = Allocations - Before;
+
+	}
+
+	printf("\nAllocations after a warm-up pass over %zu read pairs: AlignReadPair %lu, AlignBatch %lu\n", Pairs.size(), SamAllocations, EngineAllocations);
+
+	if (SamAllocations > 0 || EngineAllocations > 0) {
+		std::cerr << "ERROR: Aligning read pairs allocated memory after a warm-up pass" << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+//whole run from gzipped FASTQ to SAM written to /dev/null, as the aligner main loop does it
+static void EndToEndBenchmark(SyntheticParameters Synthetic, const unsigned Amplicons, const unsigned Threads, const string& WorkDir) {
+
+	const unsigned BatchSize = 4096;
+	string Prefix = WorkDir + "/bench_" + to_string(Amplicons), ReadGroup = "Benchmark";
+	vector<SyntheticAmplicon> Panel;
+	AlignerParameters Parameters;
+	MappingStats Totals;
+	ReadPairBatch Batch;
+	vector<FastqRecord> Records1, Records2;
+	unsigned long TotalReads = 0;
+	size_t Records, r;
+	Clock::time_point Start;
+	double LoadTime;
+
+	Synthetic.Amplicons = Amplicons;
+	SyntheticGenerator Random(Synthetic.Seed);
+	GenerateSyntheticPanel(Synthetic, Random, Panel);
+
+	if (WriteSyntheticPanel(Prefix + "_amplicons.txt", Panel) == 1 ||
+		WriteSyntheticFastq(Prefix + "_R1.fastq.gz", Prefix + "_R2.fastq.gz", Synthetic, Panel, Random) == 1) {
+		std::cerr << "ERROR: Could not write synthetic data to " << WorkDir << endl;
+		exit(-1);
+	}
+
+	DefaultParameters(Parameters);
+	AlignerEngine Engine(Parameters);
+	Start = Clock::now();
+
+	if (Engine.LoadPanel(Prefix + "_amplicons.txt") == 1) {
+		std::cerr << "ERROR: Could not load synthetic panel" << endl;
+		exit(-1);
+	}
+
+	LoadTime = Seconds(Start);
+	Start = Clock::now();
+
+	{
+		ofstream SAM_out("/dev/null");
+		FastqReader R1_in(Prefix + "_R1.fastq.gz"), R2_in(Prefix + "_R2.fastq.gz");
+		ReadPairPipeline Pipeline(Threads, Engine, ReadGroup, SAM_out);
+
+		while ((Records = min(R1_in.GetBatch(Records1, BatchSize, Batch.Buffers), R2_in.GetBatch(Records2, BatchSize, Batch.Buffers))) > 0) {
+
+			Batch.Pairs.resize(Records);
+
+			for (r = 0; r < Records; ++r) {
+				Batch.Pairs[r].Header = Records1[r].Header.substr(1, Records1[r].Header.find_first_of(' ') - 1);
+				Batch.Pairs[r].Seq1 = Records1[r].Seq;
+				Batch.Pairs[r].Seq2 = Records2[r].Seq;
+				Batch.Pairs[r].Qual1 = Records1[r].Qual;
+				Batch.Pairs[r].Qual2 = Records2[r].Qual;
+			}
+
+			TotalReads += Records;
+			Pipeline.Submit(Batch);
+
+			if (Records < BatchSize) {
+				break;
+			}
+
+		}
+
+		Pipeline.Finish(Totals);
+	}
+
+	double Elapsed = Seconds(Start);
+	printf("%-10u %10.3f s %14.3f s %12.0f %5.1f%%\n", Amplicons, LoadTime, Elapsed, TotalReads / Elapsed,
+		TotalReads ? 100.0 * Totals.TotalMappedReads / TotalReads : 0.0);
+
+	remove((Prefix + "_amplicons.txt").c_str());
+	remove((Prefix + "_R1.fastq.gz").c_str());
+	remove((Prefix + "_R2.fastq.gz").c_str());
+}
+
+int main(int argc, char* argv[]) {
+
+	const unsigned PanelSizes[] = { 10, 500, 5000 };
+	SyntheticParameters Synthetic;
+	unsigned Threads = 1;
+	bool CheckAllocations = false;
+	string WorkDir = "/tmp", Option;
+
+	SetDefaultSyntheticParameters(Synthetic);
+
+	for (int a = 1; a < argc; ++a) {
+
+		Option = argv[a];
+
+		if (Option == "--pairs" && a + 1 < argc) {
+			Synthetic.ReadPairs = strtoul(argv[++a], NULL, 10);
+		} else if (Option == "--threads" && a + 1 < argc) {
+			Threads = strtoul(argv[++a], NULL, 10);
+		} else if (Option == "--seed" && a + 1 < argc) {
+			Synthetic.Seed = strtoull(argv[++a], NULL, 10);
+		} else if (Option == "--work-dir" && a + 1 < argc) {
+			WorkDir = argv[++a];
+		} else if (Option == "--check-allocations") {
+			CheckAllocations = true;
+		} else {
+			std::cerr << "\nUsage: AmpliconAlignerBenchmark [--pairs N] [--threads N] [--seed N] [--work-dir DIR] [--check-allocations]\n" << endl;
+			return -1;
+		}
+
+	}
+
+	if (Synthetic.ReadPairs < 1 || Threads < 1) {
+		std::cerr << "ERROR: --pairs and --threads must be at least 1" << endl;
+		return -1;
+	}
+
+	try {
+
+		if (CheckAllocations) {
+			return AllocationCheck(Synthetic, WorkDir) == 1 ? -1 : 0;
+		}
+
+		MicroBenchmarks(Synthetic, WorkDir);
+
+		printf("\nEnd to end, %u thread(s), %lu read pairs\n%-10s %12s %16s %12s %6s\n", Threads, Synthetic.ReadPairs, "Amplicons", "Load", "Align", "Pairs/s", "Mapped");
+		for (unsigned p = 0; p < sizeof(PanelSizes) / sizeof(PanelSizes[0]); ++p) {
+			EndToEndBenchmark(Synthetic, PanelSizes[p], Threads, WorkDir);
+		}
+
+	} catch (exception& e) {
+		std::cerr << "ERROR: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
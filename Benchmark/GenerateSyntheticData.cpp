@@ -0,0 +1,90 @@
+/*
+* Filename : GenerateSyntheticData.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Writes a synthetic amplicon list and paired gzipped FASTQs; the same seed always gives the same files.
+* Status: Release
+*/
+
+/*
+Build from the repository root with make benchmark.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "SyntheticData.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+
+	SyntheticParameters Parameters;
+	vector<SyntheticAmplicon> Amplicons;
+	vector<string> Arguments;
+	string Option;
+	bool Usage = false;
+
+	SetDefaultSyntheticParameters(Parameters);
+
+	for (int a = 1; a < argc; ++a) {
+
+		Option = argv[a];
+
+		if (Option.compare(0, 2, "--") != 0 || a + 1 >= argc) {
+			Arguments.push_back(Option);
+			continue;
+		}
+
+		char* Value = argv[++a];
+
+		if (Option == "--amplicons") {
+			Parameters.Amplicons = strtoul(Value, NULL, 10);
+		} else if (Option == "--pairs") {
+			Parameters.ReadPairs = strtoul(Value, NULL, 10);
+		} else if (Option == "--read-length") {
+			Parameters.ReadLength = strtoul(Value, NULL, 10);
+		} else if (Option == "--seed") {
+			Parameters.Seed = strtoull(Value, NULL, 10);
+		} else if (Option == "--snv-rate") {
+			Parameters.SnvRate = atof(Value);
+		} else if (Option == "--indel-rate") {
+			Parameters.IndelRate = atof(Value);
+		} else if (Option == "--error-rate") {
+			Parameters.ErrorRate = atof(Value);
+		} else if (Option == "--primer-dimer-rate") {
+			Parameters.PrimerDimerRate = atof(Value);
+		} else if (Option == "--off-target-rate") {
+			Parameters.OffTargetRate = atof(Value);
+		} else if (Option == "--n-masked-rate") {
+			Parameters.NMaskedRate = atof(Value);
+		} else {
+			Usage = true;
+		}
+
+	}
+
+	if (Usage || Arguments.size() != 1 || Parameters.Amplicons < 1 || Parameters.ReadLength < 1) {
+		std::cerr << "\nUsage: GenerateSyntheticData [options] <OutputFilenamePrefix>\n" << endl;
+		std::cerr << "Writes <prefix>_amplicons.txt, <prefix>_R1.fastq.gz and <prefix>_R2.fastq.gz\n" << endl;
+		std::cerr << "Options: --amplicons N --pairs N --read-length N --seed N --snv-rate F --indel-rate F --error-rate F" << endl;
+		std::cerr << "         --primer-dimer-rate F --off-target-rate F --n-masked-rate F\n" << endl;
+		return -1;
+	}
+
+	SyntheticGenerator Random(Parameters.Seed);
+	GenerateSyntheticPanel(Parameters, Random, Amplicons);
+
+	if (WriteSyntheticPanel(Arguments[0] + "_amplicons.txt", Amplicons) == 1) {
+		std::cerr << "ERROR: Could not write amplicon list" << endl;
+		return -1;
+	}
+
+	if (WriteSyntheticFastq(Arguments[0] + "_R1.fastq.gz", Arguments[0] + "_R2.fastq.gz", Parameters, Amplicons, Random) == 1) {
+		std::cerr << "ERROR: Could not write FASTQ files" << endl;
+		return -1;
+	}
+
+	return 0;
+}
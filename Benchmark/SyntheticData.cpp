@@ -0,0 +1,230 @@
+/*
+* Filename : SyntheticData.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Deterministic synthetic amplicon panels and paired-end reads for benchmarking.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <zlib.h>
+#include "SyntheticData.h"
+
+using namespace std;
+
+/*									Method
+Amplicons are uniform random sequence with 18-28bp primers, between ReadLength + 10 and 2 * ReadLength - 40 bases long
+so that read pairs overlap by at least 40 bases. Each read pair copies one amplicon template, applies SNVs and at most
+one indel to the insert, then reads it from both ends: R1 is the template and R2 its reverse complement, followed by
+adapter when the template is shorter than the read (primer dimers), each given independent sequencing errors. Headers follow the Illumina 1.8 layout expected by the aligner.
+*/
+
+static const unsigned MinPrimerLen = 18, MaxPrimerLen = 28, Chromosomes = 22;
+static const char Adapter[] = "AGATCGGAAGAGCACACGTCTGAACTCCAGTCAC";
+
+uint64_t SyntheticGenerator::Next() {
+	uint64_t z = (State += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+unsigned SyntheticGenerator::Uniform(unsigned Lo, unsigned Hi) {
+	return Lo + Next() % (Hi - Lo + 1);
+}
+
+bool SyntheticGenerator::Chance(double Rate) {
+	return (Next() >> 11) * (1.0 / 9007199254740992.0) < Rate;
+}
+
+void SyntheticGenerator::RandomBases(string& Out, unsigned Len) {
+	for (unsigned n = 0; n < Len; ++n) {
+		Out += "ACGT"[Next() & 3];
+	}
+}
+
+static void ReverseComplementInPlace(string& Seq) {
+
+	string RevComp(Seq.rbegin(), Seq.rend());
+
+	for (unsigned n = 0; n < RevComp.length(); ++n) {
+		switch (RevComp[n]) {
+			case 'A': RevComp[n] = 'T'; break;
+			case 'C': RevComp[n] = 'G'; break;
+			case 'G': RevComp[n] = 'C'; break;
+			case 'T': RevComp[n] = 'A'; break;
+		}
+	}
+
+	Seq.swap(RevComp);
+}
+
+static unsigned RandomAmpliconLen(const SyntheticParameters& Parameters, SyntheticGenerator& Random) {
+	unsigned MinLen = max(Parameters.ReadLength + 10, 2 * MaxPrimerLen + 20);
+	return Random.Uniform(MinLen, max(MinLen, 2 * Parameters.ReadLength - 40));
+}
+
+//read of the template followed by adapter and random sequence; sequencing errors and qualities
+static void SequenceRead(const string& Template, const SyntheticParameters& Parameters, SyntheticGenerator& Random, string& Seq, string& Qual) {
+
+	Seq = Template.substr(0, Parameters.ReadLength);
+
+	if (Seq.length() < Parameters.ReadLength) {
+		Seq += string(Adapter).substr(0, Parameters.ReadLength - Seq.length());
+	}
+	if (Seq.length() < Parameters.ReadLength) {
+		Random.RandomBases(Seq, Parameters.ReadLength - Seq.length());
+	}
+
+	Qual.resize(Seq.length());
+
+	for (unsigned n = 0; n < Seq.length(); ++n) {
+		if (Random.Chance(Parameters.ErrorRate)) {
+			Seq[n] = "ACGT"[Random.Next() & 3];
+			Qual[n] = 33 + Random.Uniform(2, 20);
+		} else {
+			Qual[n] = 33 + Random.Uniform(25, 40);
+		}
+	}
+
+}
+
+void SetDefaultSyntheticParameters(SyntheticParameters& Parameters) {
+	Parameters.Amplicons = 500;
+	Parameters.ReadPairs = 100000;
+	Parameters.ReadLength = 151;
+	Parameters.Seed = 1;
+	Parameters.SnvRate = 0.002;
+	Parameters.IndelRate = 0.05;
+	Parameters.ErrorRate = 0.002;
+	Parameters.PrimerDimerRate = 0.02;
+	Parameters.OffTargetRate = 0.03;
+	Parameters.NMaskedRate = 0.01;
+}
+
+void GenerateSyntheticPanel(const SyntheticParameters& Parameters, SyntheticGenerator& Random, vector<SyntheticAmplicon>& Amplicons) {
+
+	SyntheticAmplicon Amplicon;
+
+	Amplicons.clear();
+
+	for (unsigned n = 0; n < Parameters.Amplicons; ++n) {
+		Amplicon.ID = "AMP" + to_string(n + 1);
+		Amplicon.Chrom = "chr" + to_string(n % Chromosomes + 1);
+		Amplicon.Pos = 10000 + (n / Chromosomes) * 1000;
+		Amplicon.Seq.clear();
+		Random.RandomBases(Amplicon.Seq, RandomAmpliconLen(Parameters, Random));
+		Amplicon.LeftPrimerLen = Random.Uniform(MinPrimerLen, MaxPrimerLen);
+		Amplicon.RightPrimerLen = Random.Uniform(MinPrimerLen, MaxPrimerLen);
+		Amplicon.Strand = (Random.Next() & 1) == 0;
+		Amplicons.push_back(Amplicon);
+	}
+
+}
+
+void GenerateSyntheticReadPair(const SyntheticParameters& Parameters, const vector<SyntheticAmplicon>& Amplicons, SyntheticGenerator& Random,
+	const unsigned long ReadNo, SyntheticReadPair& Pair) {
+
+	const SyntheticAmplicon& Amplicon = Amplicons[Random.Next() % Amplicons.size()];
+	const unsigned InsertStart = Amplicon.LeftPrimerLen, InsertEnd = Amplicon.Seq.length() - Amplicon.RightPrimerLen;
+	string Template;
+
+	Pair.Header = "M01234:12:000000000-ABCDE:1:" + to_string(1101 + ReadNo / 1000000) + ":" + to_string(1000 + ReadNo % 1000000 / 1000) + ":" + to_string(ReadNo % 1000);
+
+	if (Random.Chance(Parameters.NMaskedRate)) {
+		Pair.Seq1.assign(Parameters.ReadLength, 'N');
+		Pair.Seq2.assign(Parameters.ReadLength, 'N');
+		Pair.Qual1.assign(Parameters.ReadLength, '#');
+		Pair.Qual2.assign(Parameters.ReadLength, '#');
+		return;
+	}
+
+	if (Random.Chance(Parameters.PrimerDimerRate)) {
+		Template = Amplicon.Seq.substr(0, InsertStart) + Amplicon.Seq.substr(InsertEnd);
+	} else if (Random.Chance(Parameters.OffTargetRate)) {
+		Template = Amplicon.Seq.substr(0, InsertStart);
+		Random.RandomBases(Template, RandomAmpliconLen(Parameters, Random) - InsertStart - Amplicon.RightPrimerLen);
+		Template += Amplicon.Seq.substr(InsertEnd);
+	} else {
+
+		Template = Amplicon.Seq;
+
+		for (unsigned n = InsertStart; n < InsertEnd; ++n) {
+			if (Random.Chance(Parameters.SnvRate)) {
+				Template[n] = "ACGT"[(string("ACGT").find(Template[n]) + Random.Uniform(1, 3)) & 3];
+			}
+		}
+
+		//indels stay clear of the primers
+		if (InsertEnd - InsertStart > 60 && Random.Chance(Parameters.IndelRate)) {
+
+			unsigned Pos = Random.Uniform(InsertStart + 10, InsertEnd - 35), Len = Random.Uniform(1, 25);
+
+			if (Random.Next() & 1) {
+				Template.erase(Pos, Len);
+			} else {
+				string Inserted;
+				Random.RandomBases(Inserted, Len);
+				Template.insert(Pos, Inserted);
+			}
+
+		}
+
+	}
+
+	SequenceRead(Template, Parameters, Random, Pair.Seq1, Pair.Qual1);
+	ReverseComplementInPlace(Template);
+	SequenceRead(Template, Parameters, Random, Pair.Seq2, Pair.Qual2);
+}
+
+bool WriteSyntheticPanel(const string& Filename, const vector<SyntheticAmplicon>& Amplicons) {
+
+	FILE* Panel = fopen(Filename.c_str(), "w");
+
+	if (Panel == NULL) {
+		return 1;
+	}
+
+	for (unsigned c = 1; c <= Chromosomes; ++c) {
+		fprintf(Panel, "@SQ\tSN:chr%u\tLN:250000000\n", c);
+	}
+
+	for (unsigned n = 0; n < Amplicons.size(); ++n) {
+		fprintf(Panel, "%s\t%s\t%u\t%s\t%u\t%u\t%c\n", Amplicons[n].ID.c_str(), Amplicons[n].Chrom.c_str(), Amplicons[n].Pos, Amplicons[n].Seq.c_str(),
+			Amplicons[n].LeftPrimerLen, Amplicons[n].RightPrimerLen, Amplicons[n].Strand ? '+' : '-');
+	}
+
+	return fclose(Panel) != 0;
+}
+
+bool WriteSyntheticFastq(const string& R1Filename, const string& R2Filename, const SyntheticParameters& Parameters,
+	const vector<SyntheticAmplicon>& Amplicons, SyntheticGenerator& Random) {
+
+	gzFile R1 = gzopen(R1Filename.c_str(), "wb1"), R2 = gzopen(R2Filename.c_str(), "wb1");
+	SyntheticReadPair Pair;
+	string Record;
+	bool Failed = R1 == NULL || R2 == NULL;
+
+	for (unsigned long r = 0; r < Parameters.ReadPairs && !Failed; ++r) {
+
+		GenerateSyntheticReadPair(Parameters, Amplicons, Random, r, Pair);
+
+		Record = "@" + Pair.Header + " 1:N:0:7\n" + Pair.Seq1 + "\n+\n" + Pair.Qual1 + "\n";
+		Failed = gzwrite(R1, Record.data(), Record.size()) != (int) Record.size();
+
+		Record = "@" + Pair.Header + " 2:N:0:7\n" + Pair.Seq2 + "\n+\n" + Pair.Qual2 + "\n";
+		Failed = Failed || gzwrite(R2, Record.data(), Record.size()) != (int) Record.size();
+	}
+
+	if (R1 != NULL && gzclose(R1) != Z_OK) {
+		Failed = true;
+	}
+	if (R2 != NULL && gzclose(R2) != Z_OK) {
+		Failed = true;
+	}
+
+	return Failed;
+}
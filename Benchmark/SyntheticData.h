@@ -0,0 +1,70 @@
+/*
+* Filename : SyntheticData.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Deterministic synthetic amplicon panels and paired-end reads for benchmarking.
+* Status: Release
+*/
+
+#ifndef SYNTHETICDATA_H
+#define SYNTHETICDATA_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+typedef struct {
+	unsigned Amplicons;
+	unsigned long ReadPairs;
+	unsigned ReadLength;
+	uint64_t Seed;
+	double SnvRate; //per insert base, shared by both reads
+	double IndelRate; //per read pair; one insertion or deletion of 1-25 bases
+	double ErrorRate; //per read base, independent in R1 and R2
+	double PrimerDimerRate; //per read pair; left primer joined to the right primer
+	double OffTargetRate; //per read pair; both primers around sequence from elsewhere, as when the primer pair amplifies another locus
+	double NMaskedRate; //per read pair; all N reads
+} SyntheticParameters;
+
+typedef struct {
+	string ID;
+	string Chrom;
+	unsigned Pos;
+	string Seq; //R1 orientation: left primer, insert, reverse complement of right primer
+	unsigned LeftPrimerLen;
+	unsigned RightPrimerLen;
+	bool Strand;
+} SyntheticAmplicon;
+
+typedef struct {
+	string Header; //without the read number
+	string Seq1;
+	string Qual1;
+	string Seq2;
+	string Qual2;
+} SyntheticReadPair;
+
+class SyntheticGenerator {
+public:
+	explicit SyntheticGenerator(uint64_t Seed) : State(Seed) {}
+
+	uint64_t Next(); //splitmix64; identical on every platform
+	unsigned Uniform(unsigned Lo, unsigned Hi); //inclusive
+	bool Chance(double Rate);
+	void RandomBases(string& Out, unsigned Len);
+
+private:
+	uint64_t State;
+};
+
+void SetDefaultSyntheticParameters(SyntheticParameters& Parameters);
+void GenerateSyntheticPanel(const SyntheticParameters& Parameters, SyntheticGenerator& Random, vector<SyntheticAmplicon>& Amplicons);
+void GenerateSyntheticReadPair(const SyntheticParameters& Parameters, const vector<SyntheticAmplicon>& Amplicons, SyntheticGenerator& Random,
+	const unsigned long ReadNo, SyntheticReadPair& Pair);
+bool WriteSyntheticPanel(const string& Filename, const vector<SyntheticAmplicon>& Amplicons);
+bool WriteSyntheticFastq(const string& R1Filename, const string& R2Filename, const SyntheticParameters& Parameters,
+	const vector<SyntheticAmplicon>& Amplicons, SyntheticGenerator& Random);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+* Filename : BgzfStreamBuf.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Output stream buffer writing BGZF blocks compressed on a pool of threads.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+#include "BgzfStreamBuf.h"
+
+using namespace std;
+
+static const unsigned BgzfHeaderLen = 18, BgzfFooterLen = 8, BgzfMaxBlock = 65536;
+
+//empty block marking the end of a BGZF file
+static const unsigned char BgzfEOF[28] = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+	0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+static void PutLE(string& Block, size_t Offset, uint32_t Value, unsigned Bytes) {
+	for (unsigned b = 0; b < Bytes; ++b) {
+		Block[Offset + b] = (char) ((Value >> (8 * b)) & 0xff);
+	}
+}
+
+bool CompressBgzfBlock(const char* Data, size_t Len, string& Block) { //returns 1 on error
+
+	z_stream Stream;
+	int Level = Z_DEFAULT_COMPRESSION, Status;
+
+	Block.assign(BgzfMaxBlock, '\0');
+
+	//retry uncompressed if the data does not fit; stored deflate always does
+	for (;;) {
+
+		memset(&Stream, 0, sizeof(Stream));
+		if (deflateInit2(&Stream, Level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			return 1;
+		}
+
+		Stream.next_in = (Bytef*) Data;
+		Stream.avail_in = Len;
+		Stream.next_out = (Bytef*) &Block[BgzfHeaderLen];
+		Stream.avail_out = BgzfMaxBlock - BgzfHeaderLen - BgzfFooterLen;
+
+		Status = deflate(&Stream, Z_FINISH);
+		deflateEnd(&Stream);
+
+		if (Status == Z_STREAM_END) {
+			break;
+		} else if (Level == Z_NO_COMPRESSION) {
+			return 1;
+		}
+
+		Level = Z_NO_COMPRESSION;
+	}
+
+	size_t BlockLen = BgzfHeaderLen + Stream.total_out + BgzfFooterLen;
+	Block.resize(BlockLen);
+
+	//gzip header with the BC extra field holding the block size
+	const unsigned char Header[16] = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00 };
+	memcpy(&Block[0], Header, sizeof(Header));
+	PutLE(Block, 16, BlockLen - 1, 2);
+
+	PutLE(Block, BlockLen - 8, crc32(crc32(0L, Z_NULL, 0), (const Bytef*) Data, Len), 4);
+	PutLE(Block, BlockLen - 4, Len, 4);
+
+	return 0;
+}
+
+BgzfStreamBuf::BgzfStreamBuf(const string& Filename, unsigned Threads) :
+	File(fopen(Filename.c_str(), "wb")), Threads(Threads < 1 ? 1 : Threads), Buffer(BgzfBlockSize), BlocksSubmitted(0), FileOffset(0), StallNanoseconds(0),
+	InputQueue(2 * Threads), OutputQueue(2 * Threads), Failed(false) {
+
+	setp(&Buffer[0], &Buffer[0] + Buffer.size());
+
+	//single thread compresses inline
+	if (File != NULL && this->Threads > 1) {
+		for (unsigned t = 0; t < this->Threads; ++t) {
+			Compressors.push_back(thread(&BgzfStreamBuf::Compressor, this));
+		}
+		WriterThread = thread(&BgzfStreamBuf::Writer, this);
+	}
+
+}
+
+BgzfStreamBuf::~BgzfStreamBuf() {
+	close();
+}
+
+int BgzfStreamBuf::overflow(int c) {
+
+	FlushBlock();
+
+	if (c != traits_type::eof()) {
+		*pptr() = (char) c;
+		pbump(1);
+	}
+
+	return Failed ? traits_type::eof() : traits_type::not_eof(c);
+}
+
+int BgzfStreamBuf::sync() {
+	FlushBlock();
+	return Failed ? -1 : 0;
+}
+
+void BgzfStreamBuf::FlushBlock() {
+
+	if (pptr() > pbase()) {
+		Submit(pbase(), pptr() - pbase());
+	}
+
+	setp(&Buffer[0], &Buffer[0] + Buffer.size());
+}
+
+void BgzfStreamBuf::Submit(const char* Data, size_t Len) {
+
+	if (File == NULL || Failed) {
+		Failed = true;
+		return;
+	}
+
+	BlocksSubmitted++;
+
+	if (Threads == 1) {
+		string Block;
+		if (CompressBgzfBlock(Data, Len, Block) == 1) {
+			Failed = true;
+		} else {
+			WriteBlock(Block);
+		}
+		return;
+	}
+
+	uint64_t Start = StageClock();
+
+	if (InputQueue.Push(TBlock(BlocksSubmitted - 1, string(Data, Len))) == false) {
+		Failed = true;
+	}
+
+	StallNanoseconds += StageClock() - Start; //compression or storage is behind
+}
+
+void BgzfStreamBuf::Compressor() {
+
+	TBlock Uncompressed;
+
+	while (InputQueue.Pop(Uncompressed)) {
+
+		TBlock Compressed(Uncompressed.first, string());
+
+		if (CompressBgzfBlock(Uncompressed.second.data(), Uncompressed.second.size(), Compressed.second) == 1) {
+			Failed = true;
+		}
+
+		if (OutputQueue.Push(std::move(Compressed)) == false) {
+			return;
+		}
+	}
+
+}
+
+void BgzfStreamBuf::Writer() {
+
+	TBlock Compressed;
+	map<unsigned long, string> Pending; //blocks compressed out of order
+	unsigned long NextBlock = 0;
+
+	while (OutputQueue.Pop(Compressed)) {
+
+		Pending[Compressed.first].swap(Compressed.second);
+
+		for (auto it = Pending.find(NextBlock); it != Pending.end(); it = Pending.find(NextBlock)) {
+			WriteBlock(it->second);
+			Pending.erase(it);
+			NextBlock++;
+		}
+	}
+
+}
+
+uint64_t BgzfStreamBuf::Tell() {
+
+	//a full buffer is written first so the offset is always inside a block
+	if (pptr() == epptr()) {
+		FlushBlock();
+	}
+
+	return (uint64_t) BlocksSubmitted << 16 | (pptr() - pbase());
+}
+
+uint64_t BgzfStreamBuf::VirtualOffset(uint64_t Position) const {
+	return BlockOffsets[Position >> 16] << 16 | (Position & 0xffff);
+}
+
+void BgzfStreamBuf::AddStallTiming(StageTiming& Timing) const {
+	Timing.Nanoseconds[StageOutputStall] += StallNanoseconds;
+	Timing.Calls[StageOutputStall] += BlocksSubmitted;
+}
+
+void BgzfStreamBuf::WriteBlock(const string& Block) {
+
+	BlockOffsets.push_back(FileOffset);
+	FileOffset += Block.size();
+
+	if (fwrite(Block.data(), 1, Block.size(), File) != Block.size()) {
+		Failed = true;
+	}
+}
+
+bool BgzfStreamBuf::close() {
+
+	if (File == NULL) {
+		return false;
+	}
+
+	FlushBlock();
+
+	if (Threads > 1) {
+		InputQueue.Close();
+		for (unsigned t = 0; t < Compressors.size(); ++t) {
+			Compressors[t].join();
+		}
+		OutputQueue.Close();
+		WriterThread.join();
+		Compressors.clear();
+	}
+
+	BlockOffsets.push_back(FileOffset);
+
+	if (fwrite(BgzfEOF, 1, sizeof(BgzfEOF), File) != sizeof(BgzfEOF)) {
+		Failed = true;
+	}
+
+	if (fclose(File) != 0) {
+		Failed = true;
+	}
+
+	File = NULL;
+
+	return !Failed;
+}
@@ -0,0 +1,65 @@
+/*
+* Filename : BgzfStreamBuf.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Output stream buffer writing BGZF blocks compressed on a pool of threads.
+* Status: Release
+*/
+
+#ifndef BGZFSTREAMBUF_H
+#define BGZFSTREAMBUF_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <streambuf>
+#include <thread>
+#include <atomic>
+#include "BoundedQueue.h"
+#include "StageTiming.h"
+
+using namespace std;
+
+const unsigned BgzfBlockSize = 0xff00; //uncompressed bytes per block; leaves room for incompressible data
+
+class BgzfStreamBuf : public streambuf {
+public:
+	BgzfStreamBuf(const string& Filename, unsigned Threads);
+	~BgzfStreamBuf();
+
+	bool is_open() const { return File != NULL; }
+	bool close(); //writes remaining data and the EOF marker; false on error
+	void FlushBlock(); //ends the current block
+	uint64_t Tell(); //block number << 16 | offset in the block of the next byte written
+	uint64_t VirtualOffset(uint64_t Position) const; //BGZF virtual offset of a Tell position; valid after close
+	void AddStallTiming(StageTiming& Timing) const; //time spent waiting for the compressors to take a block
+
+protected:
+	int overflow(int c);
+	int sync();
+
+private:
+	typedef pair<unsigned long, string> TBlock;
+
+	void Compressor();
+	void Writer();
+	void Submit(const char* Data, size_t Len);
+	void WriteBlock(const string& Block);
+
+	FILE* File;
+	unsigned Threads;
+	vector<char> Buffer;
+	unsigned long BlocksSubmitted;
+	vector<uint64_t> BlockOffsets; //file offset of each block written, then of the EOF marker
+	uint64_t FileOffset;
+	uint64_t StallNanoseconds;
+	BoundedQueue<TBlock> InputQueue, OutputQueue;
+	vector<thread> Compressors;
+	thread WriterThread;
+	atomic<bool> Failed;
+};
+
+bool CompressBgzfBlock(const char* Data, size_t Len, string& Block);
+
+#endif
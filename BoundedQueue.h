@@ -0,0 +1,62 @@
+/*
+* Filename : BoundedQueue.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Blocking first-in first-out queue with a fixed capacity for passing work between threads.
+* Status: Release
+*/
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t Capacity) : Capacity(Capacity), Closed(false) {}
+
+	//blocks while the queue is full; returns false if the queue has been closed
+	bool Push(T&& Item) {
+		std::unique_lock<std::mutex> Lock(Mutex);
+		NotFull.wait(Lock, [this] { return Items.size() < Capacity || Closed; });
+		if (Closed) {
+			return false;
+		}
+		Items.push_back(std::move(Item));
+		NotEmpty.notify_one();
+		return true;
+	}
+
+	//blocks while the queue is empty; returns false once closed and drained
+	bool Pop(T& Item) {
+		std::unique_lock<std::mutex> Lock(Mutex);
+		NotEmpty.wait(Lock, [this] { return !Items.empty() || Closed; });
+		if (Items.empty()) {
+			return false;
+		}
+		Item = std::move(Items.front());
+		Items.pop_front();
+		NotFull.notify_one();
+		return true;
+	}
+
+	//no more items will be pushed; wakes all waiting threads
+	void Close() {
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Closed = true;
+		NotEmpty.notify_all();
+		NotFull.notify_all();
+	}
+
+private:
+	size_t Capacity;
+	bool Closed;
+	std::deque<T> Items;
+	std::mutex Mutex;
+	std::condition_variable NotEmpty, NotFull;
+};
+
+#endif
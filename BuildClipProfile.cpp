@@ -0,0 +1,51 @@
+/*
+* Filename : BuildClipProfile.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Precomputes the striped local alignment query profile of a primer used to clip reads.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+The primer is split into Segments runs so that 16 byte lanes cover it (Farrar striped layout). For every read base the
+profile holds the score of that base against each primer position, biased by 2 so that match 1 and mismatch -2 are
+stored as 3 and 0. Positions past the end of the primer score as mismatches; they can only follow the last primer
+base and never raise the best score. Read bases other than ACGT mismatch everywhere as they do in the base comparison.
+*/
+
+bool BuildClipProfile(const string& Primer, ClipProfile& Profile) {
+
+	const char Bases[] = "ACGT";
+	const unsigned Lanes = 16, MatchScore = 1 + 2, MismatchScore = -2 + 2;
+	unsigned Code, s, l, j;
+
+	if (Primer.length() > ClipProfileMaxPrimerLen) {
+		return 1;
+	}
+
+	Profile.Primer = Primer;
+	Profile.Segments = (Primer.length() + Lanes - 1) / Lanes;
+	Profile.Scores.assign(5 * Profile.Segments * Lanes, MismatchScore);
+
+	for (Code = 0; Code < 4; ++Code) {
+		for (s = 0; s < Profile.Segments; ++s) {
+			for (l = 0; l < Lanes; ++l) {
+
+				j = s + l * Profile.Segments;
+
+				if (j < Primer.length() && Primer[j] == Bases[Code]) {
+					Profile.Scores[(Code * Profile.Segments + s) * Lanes + l] = MatchScore;
+				}
+
+			}
+		}
+	}
+
+	return 0;
+}
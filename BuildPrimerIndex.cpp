@@ -0,0 +1,131 @@
+/*
+* Filename : BuildPrimerIndex.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Builds an exact seed index over left primers so reads can be dispatched to their amplicon without scanning the panel.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+MatchPrimer accepts a read when the last 2bp of the primer match exactly and more than 80% of the primer matches overall,
+so an accepted read has at most MaxMismatches errors, all before the last 2bp. Tiling those bases with MaxMismatches + 1
+blocks guarantees at least one block matches exactly (pigeonhole). Each block plus the exact 3' bases is hashed as a seed;
+every candidate found through a seed is verified with MatchPrimer so accept/reject decisions are unchanged.
+*/
+
+unsigned MaxPrimerMismatches(const unsigned PrimerLen) { //largest number of mismatches MatchPrimer still accepts
+
+	unsigned MaxMismatchLen = 3, mm;
+	float BasesMatched;
+
+	for (mm = 0; mm < PrimerLen; ++mm) {
+		BasesMatched = PrimerLen - (mm + 1);
+		if (!(BasesMatched / (PrimerLen - MaxMismatchLen) > 0.8)) {
+			break;
+		}
+	}
+
+	return mm;
+}
+
+bool BuildPrimerIndex(const vector<AmpliconRecord>& AmpliconRecords, PrimerIndex& Index) {
+
+	vector<pair<uint64_t, unsigned>> Seeds; //key, amplicon
+	vector<unsigned> PrimerLengths;
+	unsigned n, b, l, BlockLen, Blocks, MaxMismatches;
+	uint64_t Key;
+
+	Index.Layouts.clear();
+	Index.Buckets.clear();
+	Index.SeedKeys.clear();
+	Index.SeedAmplicons.clear();
+	Index.Unindexed.clear();
+
+	//one seed layout per distinct primer length
+	for (n = 0; n < AmpliconRecords.size(); ++n) {
+		PrimerLengths.push_back(AmpliconRecords[n].LeftPrimer.length());
+	}
+	sort(PrimerLengths.begin(), PrimerLengths.end());
+	PrimerLengths.erase(unique(PrimerLengths.begin(), PrimerLengths.end()), PrimerLengths.end());
+
+	for (l = 0; l < PrimerLengths.size(); ++l) {
+
+		PrimerSeedLayout Layout;
+		Layout.PrimerLen = PrimerLengths[l];
+
+		if (Layout.PrimerLen > 3) {
+
+			MaxMismatches = MaxPrimerMismatches(Layout.PrimerLen);
+			Blocks = MaxMismatches + 1;
+
+			if (Blocks <= Layout.PrimerLen - 2) { //otherwise no block is guaranteed to be exact
+
+				for (b = 0; b < Blocks; ++b) {
+					Layout.BlockStarts.push_back(b * (Layout.PrimerLen - 2) / Blocks);
+					BlockLen = (b + 1) * (Layout.PrimerLen - 2) / Blocks - Layout.BlockStarts.back();
+					Layout.BlockLens.push_back(min(BlockLen, PrimerSeedMaxBases - 2)); //a prefix of an exact block is also exact
+				}
+
+			}
+
+		}
+
+		Index.Layouts.push_back(Layout);
+	}
+
+	//hash seeds from each primer
+	for (n = 0; n < AmpliconRecords.size(); ++n) {
+
+		const PackedSequence& Primer = AmpliconRecords[n].LeftPrimerPacked;
+		const PrimerSeedLayout& Layout = Index.Layouts[lower_bound(PrimerLengths.begin(), PrimerLengths.end(), Primer.Length) - PrimerLengths.begin()];
+
+		if (Layout.BlockStarts.size() == 0) {
+			Index.Unindexed.push_back(n); //short primer; always checked
+			continue;
+		}
+
+		for (b = 0; b < Layout.BlockStarts.size(); ++b) {
+			if (PrimerSeedKey(Primer, Layout, b, Key) == false) {
+				return 1; //primers are validated as ACGT so this should not happen
+			}
+			Seeds.push_back(make_pair(Key, n));
+		}
+
+	}
+
+	//pack seeds into buckets; power of two and at least half empty
+	unsigned long BucketCount = 1;
+	while (BucketCount < Seeds.size() * 2) {
+		BucketCount <<= 1;
+	}
+
+	Index.BucketMask = BucketCount - 1;
+	Index.Buckets.assign(BucketCount + 1, 0);
+
+	for (n = 0; n < Seeds.size(); ++n) {
+		Index.Buckets[(Seeds[n].first & Index.BucketMask) + 1]++;
+	}
+	for (n = 0; n < BucketCount; ++n) {
+		Index.Buckets[n + 1] += Index.Buckets[n];
+	}
+
+	//seeds stay in amplicon order within each bucket
+	vector<unsigned> Fill(Index.Buckets.begin(), Index.Buckets.end() - 1);
+	Index.SeedKeys.resize(Seeds.size());
+	Index.SeedAmplicons.resize(Seeds.size());
+
+	for (n = 0; n < Seeds.size(); ++n) {
+		unsigned Slot = Fill[Seeds[n].first & Index.BucketMask]++;
+		Index.SeedKeys[Slot] = Seeds[n].first;
+		Index.SeedAmplicons[Slot] = Seeds[n].second;
+	}
+
+	return 0;
+}
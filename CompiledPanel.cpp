@@ -0,0 +1,373 @@
+/*
+* Filename : CompiledPanel.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Writes a loaded amplicon panel and everything derived from it to a binary file and maps it back without parsing.
+* Status: Release
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+The file holds a fixed header then a payload of every AmpliconRecord field, the SAM headers and the left primer index,
+as written by GetAmplicons; strings and vectors are a length then their bytes. The header gives the format version, a key
+of the build constants the derived fields depend on, the CRC32 of the payload and the path and CRC32 of the amplicon
+file it was compiled from. Loading maps the file, checks the header and CRCs and copies the fields straight out; files
+from another version or build, truncated files and files whose amplicon list has since changed are rejected.
+*/
+
+static const char CompiledPanelMagic[8] = { 'A', 'A', 'P', 'A', 'N', 'E', 'L', '\1' };
+static const uint32_t CompiledPanelVersion = 2; //increase when a stored or derived field changes
+
+//build constants that shape the stored profiles, packed primers and index
+static uint32_t CompiledPanelLayout() {
+	return (uint32_t) (sizeof(PackedSequence) ^ PackedSequenceMaxBases << 8 ^ ClipProfileMaxPrimerLen << 16 ^ AlignmentProfilePad << 20 ^ PrimerSeedMaxBases << 26);
+}
+
+typedef struct {
+	const char* Data;
+	size_t Size;
+	size_t Offset;
+	bool Failed; //read past the end
+} TPanelReader;
+
+template <class T> static void AppendValue(string& Out, const T& Value) {
+	Out.append((const char*) &Value, sizeof(T));
+}
+
+static void AppendString(string& Out, const string& Value) {
+	AppendValue(Out, (uint64_t) Value.size());
+	Out += Value;
+}
+
+template <class T> static void AppendVector(string& Out, const vector<T>& Values) {
+	AppendValue(Out, (uint64_t) Values.size());
+	Out.append((const char*) Values.data(), Values.size() * sizeof(T));
+}
+
+template <class T> static void ReadValue(TPanelReader& In, T& Value) {
+
+	if (In.Failed || In.Size - In.Offset < sizeof(T)) {
+		In.Failed = true;
+		return;
+	}
+
+	memcpy(&Value, In.Data + In.Offset, sizeof(T));
+	In.Offset += sizeof(T);
+}
+
+static void ReadString(TPanelReader& In, string& Value) {
+
+	uint64_t Len = 0;
+
+	ReadValue(In, Len);
+
+	if (In.Failed || In.Size - In.Offset < Len) {
+		In.Failed = true;
+		return;
+	}
+
+	Value.assign(In.Data + In.Offset, Len);
+	In.Offset += Len;
+}
+
+template <class T> static void ReadVector(TPanelReader& In, vector<T>& Values) {
+
+	uint64_t Count = 0;
+
+	ReadValue(In, Count);
+
+	if (In.Failed || (In.Size - In.Offset) / sizeof(T) < Count) {
+		In.Failed = true;
+		return;
+	}
+
+	Values.resize(Count);
+	memcpy(Values.data(), In.Data + In.Offset, Count * sizeof(T));
+	In.Offset += Count * sizeof(T);
+}
+
+//field by field; the struct's padding is never set, so writing it whole would make the file differ between runs
+static void AppendPackedSequence(string& Out, const PackedSequence& Seq) {
+	AppendValue(Out, Seq.Low);
+	AppendValue(Out, Seq.High);
+	AppendValue(Out, Seq.NMask);
+	AppendValue(Out, Seq.Length);
+	AppendValue(Out, Seq.Exact);
+}
+
+static void ReadPackedSequence(TPanelReader& In, PackedSequence& Seq) {
+	ReadValue(In, Seq.Low);
+	ReadValue(In, Seq.High);
+	ReadValue(In, Seq.NMask);
+	ReadValue(In, Seq.Length);
+	ReadValue(In, Seq.Exact);
+}
+
+static void AppendClipProfile(string& Out, const ClipProfile& Profile) {
+	AppendString(Out, Profile.Primer);
+	AppendValue(Out, Profile.Segments);
+	AppendVector(Out, Profile.Scores);
+}
+
+static void ReadClipProfile(TPanelReader& In, ClipProfile& Profile) {
+	ReadString(In, Profile.Primer);
+	ReadValue(In, Profile.Segments);
+	ReadVector(In, Profile.Scores);
+}
+
+//CRC32 of a file's contents; returns 1 if it cannot be read
+static bool GetFileCRC(const string& Filename, uint32_t& CRC) {
+
+	ifstream File_in(Filename, ios::binary);
+	vector<char> Buffer(1 << 16);
+
+	if (!File_in.is_open()) {
+		return 1;
+	}
+
+	CRC = crc32(0L, Z_NULL, 0);
+
+	while (File_in.read(Buffer.data(), Buffer.size()) || File_in.gcount() > 0) {
+		CRC = crc32(CRC, (const Bytef*) Buffer.data(), File_in.gcount());
+	}
+
+	return File_in.bad();
+}
+
+bool WriteCompiledPanel(const string& Filename, const string& AmpliconFilename, const AmpliconPanel& Panel) {
+
+	string Payload, Header;
+	char SourcePath[PATH_MAX];
+	uint32_t SourceCRC;
+	unsigned n;
+
+	if (GetFileCRC(AmpliconFilename, SourceCRC) == 1) {
+		std::cerr << "ERROR: Unable to open amplicon file" << endl;
+		return 1;
+	}
+
+	//records
+	AppendValue(Payload, (uint64_t) Panel.AmpliconRecords.size());
+
+	for (n = 0; n < Panel.AmpliconRecords.size(); ++n) {
+
+		const AmpliconRecord& Amplicon = Panel.AmpliconRecords[n];
+
+		AppendString(Payload, Amplicon.ID);
+		AppendString(Payload, Amplicon.Chrom);
+		AppendString(Payload, Amplicon.RefSeq);
+		AppendValue(Payload, Amplicon.Pos);
+		AppendString(Payload, Amplicon.LeftPrimer);
+		AppendString(Payload, Amplicon.RightPrimer);
+		AppendPackedSequence(Payload, Amplicon.LeftPrimerPacked);
+		AppendPackedSequence(Payload, Amplicon.RightPrimerPacked);
+		AppendVector(Payload, Amplicon.KmerFilter);
+		AppendValue(Payload, Amplicon.LeftPrimerLen);
+		AppendValue(Payload, Amplicon.RightPrimerLen);
+		AppendValue(Payload, Amplicon.Strand);
+		AppendValue(Payload, Amplicon.RefID);
+		AppendClipProfile(Payload, Amplicon.RightPrimerClip);
+		AppendClipProfile(Payload, Amplicon.LeftPrimerClip);
+		AppendVector(Payload, Amplicon.Alignment.RefPad);
+		AppendValue(Payload, Amplicon.Alignment.RefLen);
+		AppendValue(Payload, Amplicon.Alignment.LeftPrimerLen);
+		AppendValue(Payload, Amplicon.Alignment.RightPrimerLen);
+		AppendString(Payload, Amplicon.SamPrefix);
+		AppendString(Payload, Amplicon.SamSuffix);
+	}
+
+	//SAM headers
+	AppendValue(Payload, (uint64_t) Panel.SamHeaders.size());
+	for (n = 0; n < Panel.SamHeaders.size(); ++n) {
+		AppendString(Payload, Panel.SamHeaders[n]);
+	}
+
+	//left primer index
+	const PrimerIndex& Index = Panel.LeftPrimerIndex;
+
+	AppendValue(Payload, (uint64_t) Index.Layouts.size());
+	for (n = 0; n < Index.Layouts.size(); ++n) {
+		AppendValue(Payload, Index.Layouts[n].PrimerLen);
+		AppendVector(Payload, Index.Layouts[n].BlockStarts);
+		AppendVector(Payload, Index.Layouts[n].BlockLens);
+	}
+	AppendValue(Payload, Index.BucketMask);
+	AppendVector(Payload, Index.Buckets);
+	AppendVector(Payload, Index.SeedKeys);
+	AppendVector(Payload, Index.SeedAmplicons);
+	AppendVector(Payload, Index.Unindexed);
+
+	//staleness is checked against the amplicon file wherever the panel is used from
+	if (realpath(AmpliconFilename.c_str(), SourcePath) == NULL) {
+		strncpy(SourcePath, AmpliconFilename.c_str(), sizeof(SourcePath) - 1);
+		SourcePath[sizeof(SourcePath) - 1] = '\0';
+	}
+
+	Header.append(CompiledPanelMagic, sizeof(CompiledPanelMagic));
+	AppendValue(Header, CompiledPanelVersion);
+	AppendValue(Header, CompiledPanelLayout());
+	AppendValue(Header, (uint32_t) crc32(crc32(0L, Z_NULL, 0), (const Bytef*) Payload.data(), Payload.size()));
+	AppendValue(Header, SourceCRC);
+	AppendString(Header, SourcePath);
+	AppendValue(Header, (uint64_t) Payload.size());
+
+	ofstream Panel_out(Filename, ios::binary);
+
+	Panel_out.write(Header.data(), Header.size());
+	Panel_out.write(Payload.data(), Payload.size());
+	Panel_out.close();
+
+	if (Panel_out.fail()) {
+		std::cerr << "ERROR: Could not write compiled panel " << Filename << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+bool isCompiledPanel(const string& Filename) {
+
+	char Magic[sizeof(CompiledPanelMagic)];
+	ifstream Panel_in(Filename, ios::binary);
+
+	return Panel_in.read(Magic, sizeof(Magic)) && memcmp(Magic, CompiledPanelMagic, sizeof(Magic)) == 0;
+}
+
+bool ReadCompiledPanel(const string& Filename, AmpliconPanel& Panel) {
+
+	TPanelReader In = { NULL, 0, 0, false };
+	struct stat FileStat;
+	void* Mapped;
+	char Magic[sizeof(CompiledPanelMagic)];
+	uint32_t Version = 0, Layout = 0, PayloadCRC = 0, SourceCRC = 0, CurrentCRC;
+	uint64_t PayloadBytes = 0, Count = 0;
+	string SourcePath;
+	int File;
+	unsigned n;
+	bool Failed = false;
+
+	if ((File = open(Filename.c_str(), O_RDONLY)) < 0) {
+		std::cerr << "ERROR: Unable to open compiled panel " << Filename << endl;
+		return 1;
+	}
+
+	if (fstat(File, &FileStat) != 0 || FileStat.st_size < (off_t) sizeof(Magic) ||
+		(Mapped = mmap(NULL, FileStat.st_size, PROT_READ, MAP_PRIVATE, File, 0)) == MAP_FAILED) {
+		std::cerr << "ERROR: Unable to map compiled panel " << Filename << endl;
+		close(File);
+		return 1;
+	}
+
+	close(File); //the mapping stays valid
+
+	In.Data = (const char*) Mapped;
+	In.Size = FileStat.st_size;
+
+	//header
+	ReadValue(In, Magic);
+	ReadValue(In, Version);
+	ReadValue(In, Layout);
+	ReadValue(In, PayloadCRC);
+	ReadValue(In, SourceCRC);
+	ReadString(In, SourcePath);
+	ReadValue(In, PayloadBytes);
+
+	if (In.Failed || memcmp(Magic, CompiledPanelMagic, sizeof(Magic)) != 0) {
+		std::cerr << "ERROR: " << Filename << " is not a compiled panel" << endl;
+		Failed = true;
+	} else if (Version != CompiledPanelVersion || Layout != CompiledPanelLayout()) {
+		std::cerr << "ERROR: " << Filename << " was compiled by another version of AmpliconAligner; run compile-panel again" << endl;
+		Failed = true;
+	} else if (In.Size - In.Offset != PayloadBytes || crc32(crc32(0L, Z_NULL, 0), (const Bytef*) In.Data + In.Offset, PayloadBytes) != PayloadCRC) {
+		std::cerr << "ERROR: " << Filename << " is truncated or corrupt" << endl;
+		Failed = true;
+	} else if (GetFileCRC(SourcePath, CurrentCRC) == 0 && CurrentCRC != SourceCRC) { //a panel may be used without its amplicon file
+		std::cerr << "ERROR: " << SourcePath << " has changed since " << Filename << " was compiled; run compile-panel again" << endl;
+		Failed = true;
+	}
+
+	if (Failed) {
+		munmap(Mapped, FileStat.st_size);
+		return 1;
+	}
+
+	//records
+	ReadValue(In, Count);
+	Panel.AmpliconRecords.resize(In.Failed ? 0 : min<uint64_t>(Count, In.Size));
+
+	for (n = 0; n < Panel.AmpliconRecords.size() && !In.Failed; ++n) {
+
+		AmpliconRecord& Amplicon = Panel.AmpliconRecords[n];
+
+		ReadString(In, Amplicon.ID);
+		ReadString(In, Amplicon.Chrom);
+		ReadString(In, Amplicon.RefSeq);
+		ReadValue(In, Amplicon.Pos);
+		ReadString(In, Amplicon.LeftPrimer);
+		ReadString(In, Amplicon.RightPrimer);
+		ReadPackedSequence(In, Amplicon.LeftPrimerPacked);
+		ReadPackedSequence(In, Amplicon.RightPrimerPacked);
+		ReadVector(In, Amplicon.KmerFilter);
+		ReadValue(In, Amplicon.LeftPrimerLen);
+		ReadValue(In, Amplicon.RightPrimerLen);
+		ReadValue(In, Amplicon.Strand);
+		ReadValue(In, Amplicon.RefID);
+		ReadClipProfile(In, Amplicon.RightPrimerClip);
+		ReadClipProfile(In, Amplicon.LeftPrimerClip);
+		ReadVector(In, Amplicon.Alignment.RefPad);
+		ReadValue(In, Amplicon.Alignment.RefLen);
+		ReadValue(In, Amplicon.Alignment.LeftPrimerLen);
+		ReadValue(In, Amplicon.Alignment.RightPrimerLen);
+		ReadString(In, Amplicon.SamPrefix);
+		ReadString(In, Amplicon.SamSuffix);
+	}
+
+	//SAM headers
+	ReadValue(In, Count);
+	Panel.SamHeaders.resize(In.Failed ? 0 : min<uint64_t>(Count, In.Size));
+	for (n = 0; n < Panel.SamHeaders.size() && !In.Failed; ++n) {
+		ReadString(In, Panel.SamHeaders[n]);
+	}
+
+	//left primer index
+	PrimerIndex& Index = Panel.LeftPrimerIndex;
+
+	ReadValue(In, Count);
+	Index.Layouts.resize(In.Failed ? 0 : min<uint64_t>(Count, In.Size));
+	for (n = 0; n < Index.Layouts.size() && !In.Failed; ++n) {
+		ReadValue(In, Index.Layouts[n].PrimerLen);
+		ReadVector(In, Index.Layouts[n].BlockStarts);
+		ReadVector(In, Index.Layouts[n].BlockLens);
+	}
+	ReadValue(In, Index.BucketMask);
+	ReadVector(In, Index.Buckets);
+	ReadVector(In, Index.SeedKeys);
+	ReadVector(In, Index.SeedAmplicons);
+	ReadVector(In, Index.Unindexed);
+
+	munmap(Mapped, FileStat.st_size);
+
+	if (In.Failed || In.Offset != In.Size) {
+		std::cerr << "ERROR: " << Filename << " is improperly formatted" << endl;
+		return 1;
+	}
+
+	return 0;
+}
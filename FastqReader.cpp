@@ -0,0 +1,436 @@
+/*
+* Filename : FastqReader.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Reads FASTQ records from gzipped or plain files, pipes or stdin, decompressing on a dedicated thread.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include "FastqReader.h"
+
+using namespace std;
+
+/*									Method
+The decompression thread inflates into a pending buffer while counting non-empty lines, and hands the buffer over
+once it holds ChunkSize bytes, cut after the last complete 4-line record. Records therefore never span chunks and the
+reading thread only splits lines. Multi-member gzip (including BGZF) is inflated as consecutive members. With
+HAVE_LIBDEFLATE (on in the Makefile when libdeflate is installed) each member that fits in the input buffer is
+inflated whole by libdeflate, which is several times faster than zlib; BGZF blocks and the multi-member files written by
+most sequencers fit. A member larger than the buffer, such as a whole file compressed by gzip as one member, is streamed
+through zlib from there on, as is everything without libdeflate. Compression is recognised from the gzip
+magic bytes, not the file name, and the input is only read forwards so pipes and stdin ("-") work as files do.
+*/
+
+static const size_t InputSize = 4 << 20, ChunkSize = 8 << 20, InflateStep = 1 << 20;
+static const size_t MemberRatio = 8, MaxMemberOutput = 256 << 20; //first guess at a gzip member's inflated size per compressed byte; largest tried
+static const unsigned ChunkQueueLen = 4; //chunks decompressed ahead of the reader
+
+static runtime_error GzipError(const string& Message) {
+	return runtime_error("Problem with gzip extraction: " + Message);
+}
+
+FastqReader::FastqReader(const string& Filename) :
+	Descriptor(Filename == "-" ? STDIN_FILENO : open(Filename.c_str(), O_RDONLY)), Chunks(ChunkQueueLen), ScanPos(0), LineStart(0), RecordEnd(0), LinesInRecord(0),
+	DecompressNanoseconds(0), DecompressCalls(0), ChunkPos(0), Finished(false) {
+
+	if (Descriptor >= 0) {
+		Decompressor = thread(&FastqReader::Decompress, this);
+	}
+
+}
+
+FastqReader::~FastqReader() {
+
+	Chunks.Close(); //stops the decompression thread if the reader finished early
+
+	if (Decompressor.joinable()) {
+		Decompressor.join();
+	}
+
+	if (Descriptor > STDIN_FILENO) {
+		close(Descriptor);
+	}
+
+}
+
+size_t FastqReader::GetBatch(vector<FastqRecord>& Batch, size_t MaxRecords, vector<shared_ptr<const string>>& Buffers) {
+
+	const char *Line[4];
+	size_t Len[4], Records = 0;
+	unsigned l;
+
+	if (Batch.size() < MaxRecords) {
+		Batch.resize(MaxRecords);
+	}
+
+	while (Records < MaxRecords) {
+
+		for (l = 0; l < 4; ++l) {
+			if (NextLine(Line[l], Len[l]) == false) {
+				return Records; //incomplete trailing records are ignored
+			}
+		}
+
+		//records never span chunks
+		if (Buffers.empty() || Buffers.back() != Chunk) {
+			Buffers.push_back(Chunk);
+		}
+
+		Batch[Records].Header = string_view(Line[0], Len[0]);
+		Batch[Records].Seq = string_view(Line[1], Len[1]);
+		Batch[Records].Qual = string_view(Line[3], Len[3]);
+		Records++;
+	}
+
+	return Records;
+}
+
+void FastqReader::AddDecompressTiming(StageTiming& Timing) const {
+	Timing.Nanoseconds[StageDecompress] += DecompressNanoseconds;
+	Timing.Calls[StageDecompress] += DecompressCalls;
+}
+
+//next non-empty line of the current chunk; fetches chunks as needed
+bool FastqReader::NextLine(const char*& Line, size_t& Len) {
+
+	for (;;) {
+
+		while (Chunk && ChunkPos < Chunk->size()) {
+
+			const char* Start = Chunk->data() + ChunkPos;
+			const char* End = (const char*) memchr(Start, '\n', Chunk->size() - ChunkPos);
+			size_t LineLen = End == NULL ? Chunk->size() - ChunkPos : End - Start;
+
+			ChunkPos += LineLen + 1;
+
+			if (LineLen > 0) { //skip empty lines
+				Line = Start;
+				Len = LineLen;
+				return true;
+			}
+		}
+
+		if (Finished) {
+			return false;
+		}
+
+		if (Chunks.Pop(Chunk) == false) {
+			Finished = true;
+			Chunk.reset();
+			if (Error) {
+				rethrow_exception(Error);
+			}
+			return false;
+		}
+
+		ChunkPos = 0;
+	}
+
+}
+
+void FastqReader::Decompress() {
+
+	vector<char> In(InputSize);
+	size_t InLen = 0;
+	bool Eof = false;
+
+	try {
+
+		Eof = !Fill(In, InLen, 0);
+
+		if (InLen >= 2 && (unsigned char) In[0] == 0x1f && (unsigned char) In[1] == 0x8b) {
+
+#ifdef HAVE_LIBDEFLATE
+			InflateMembers(In, InLen, Eof);
+#else
+			InflateGzip(In, InLen, Eof);
+#endif
+
+		} else {
+
+			//not compressed
+			while (InLen > 0) {
+				Append(&In[0], InLen);
+				InLen = 0;
+				if (Fill(In, InLen, 0) == false) {
+					break;
+				}
+			}
+
+		}
+
+		Emit(true);
+
+	} catch (...) {
+		Error = current_exception();
+	}
+
+	Chunks.Close();
+}
+
+//moves In[Keep, InLen) to the front and reads until In is full; false if nothing more could be read
+bool FastqReader::Fill(vector<char>& In, size_t& InLen, size_t Keep) {
+
+	size_t Before;
+	ssize_t Read;
+
+	memmove(&In[0], &In[Keep], InLen - Keep);
+	InLen -= Keep;
+	Before = InLen;
+
+	while (InLen < In.size()) {
+		Read = read(Descriptor, &In[InLen], In.size() - InLen);
+		if (Read < 0) {
+			throw runtime_error("Unable to read FASTQ file");
+		} else if (Read == 0) {
+			break;
+		}
+		InLen += Read;
+	}
+
+	return InLen > Before;
+}
+
+void FastqReader::InflateGzip(vector<char>& In, size_t& InLen, bool& Eof) {
+
+	z_stream Stream;
+	int Status;
+	char* Out;
+
+	memset(&Stream, 0, sizeof(Stream));
+	if (inflateInit2(&Stream, 15 + 16) != Z_OK) {
+		throw GzipError("could not initialise zlib");
+	}
+
+	Stream.next_in = (Bytef*) &In[0];
+	Stream.avail_in = InLen;
+
+	for (;;) {
+
+		if (Stream.avail_in == 0 && !Eof) {
+			InLen = 0;
+			Eof = !Fill(In, InLen, 0);
+			Stream.next_in = (Bytef*) &In[0];
+			Stream.avail_in = InLen;
+		}
+
+		Out = Reserve(InflateStep);
+		Stream.next_out = (Bytef*) Out;
+		Stream.avail_out = InflateStep;
+
+		uint64_t Start = StageClock();
+		Status = inflate(&Stream, Z_NO_FLUSH);
+		DecompressNanoseconds += StageClock() - Start;
+		DecompressCalls++;
+		Commit(InflateStep - Stream.avail_out);
+
+		if (Status == Z_STREAM_END) {
+
+			//another member follows? (multi-member gzip and BGZF)
+			if (Stream.avail_in < 2 && !Eof) {
+				size_t Consumed = (char*) Stream.next_in - &In[0];
+				Eof = !Fill(In, InLen, Consumed);
+				Stream.next_in = (Bytef*) &In[0];
+				Stream.avail_in = InLen;
+			}
+
+			if (Stream.avail_in < 2 || Stream.next_in[0] != 0x1f || Stream.next_in[1] != 0x8b) {
+				break; //end of data; trailing bytes that are not gzip are ignored
+			}
+
+			inflateReset(&Stream);
+
+		} else if (Status == Z_BUF_ERROR && Stream.avail_in == 0 && Eof) {
+			inflateEnd(&Stream);
+			throw GzipError("unexpected end of file");
+		} else if (Status != Z_OK && Status != Z_BUF_ERROR) {
+			string Message = Stream.msg != NULL ? Stream.msg : "corrupt data";
+			inflateEnd(&Stream);
+			throw GzipError(Message);
+		}
+
+	}
+
+	inflateEnd(&Stream);
+}
+
+#ifdef HAVE_LIBDEFLATE
+void FastqReader::InflateMembers(vector<char>& In, size_t& InLen, bool& Eof) {
+
+	libdeflate_decompressor* Decompressor = libdeflate_alloc_decompressor();
+	unique_ptr<char[]> Guessed; //members of unknown size are inflated here then appended
+	size_t Pos = 0, GuessedLen = 0, OutLen, Used, Actual;
+	const unsigned char* Member;
+	libdeflate_result Result;
+	char* Out;
+	bool Exact;
+
+	if (Decompressor == NULL) {
+		throw GzipError("could not initialise libdeflate");
+	}
+
+	try {
+		for (;;) {
+
+			//keep at least half a buffer of input ahead so most members are whole
+			if (!Eof && InLen - Pos < In.size() / 2) {
+				Eof = !Fill(In, InLen, Pos);
+				Pos = 0;
+			}
+			if (InLen - Pos < 2) {
+				break;
+			}
+
+			Member = (const unsigned char*) &In[Pos];
+			if (Member[0] != 0x1f || Member[1] != 0x8b) {
+				break; //trailing bytes that are not gzip are ignored
+			}
+
+			//BGZF blocks give their inflated size; otherwise guess and grow
+			Exact = InLen - Pos >= 18 && (Member[3] & 4) && Member[12] == 'B' && Member[13] == 'C' && (size_t) (Member[16] | Member[17] << 8) + 1 <= InLen - Pos;
+
+			if (Exact) {
+				Used = (Member[16] | Member[17] << 8) + 1;
+				OutLen = Member[Used - 4] | Member[Used - 3] << 8 | Member[Used - 2] << 16 | (uint32_t) Member[Used - 1] << 24;
+			} else {
+				OutLen = min(max(InflateStep, MemberRatio * (InLen - Pos)), MaxMemberOutput);
+			}
+
+			for (;;) {
+
+				if (Exact) {
+					Out = Reserve(OutLen);
+				} else {
+					if (GuessedLen < OutLen) {
+						Guessed.reset(new char[OutLen]); //not initialised; only written pages are touched
+						GuessedLen = OutLen;
+					}
+					Out = Guessed.get();
+				}
+
+				uint64_t Start = StageClock();
+				Result = libdeflate_gzip_decompress_ex(Decompressor, Member, InLen - Pos, Out, OutLen, &Used, &Actual);
+				DecompressNanoseconds += StageClock() - Start;
+				DecompressCalls++;
+
+				if (Exact) {
+					Commit(Result == LIBDEFLATE_SUCCESS ? Actual : 0);
+				}
+
+				if (Result != LIBDEFLATE_INSUFFICIENT_SPACE || Exact || OutLen >= MaxMemberOutput) {
+					break;
+				}
+
+				OutLen = min(2 * OutLen, MaxMemberOutput);
+			}
+
+			if (Result == LIBDEFLATE_SUCCESS) {
+				if (!Exact) {
+					Append(Out, Actual);
+				}
+				Pos += Used;
+				continue;
+			}
+
+			if (Result == LIBDEFLATE_BAD_DATA && !Eof && Pos > 0) {
+				Eof = !Fill(In, InLen, Pos); //member was cut off by the end of the buffer
+				Pos = 0;
+				continue;
+			} else if (Result == LIBDEFLATE_BAD_DATA && Eof) {
+				throw GzipError("corrupt or truncated gzip member");
+			}
+
+			//member longer than the input buffer or MaxMemberOutput; zlib streams it and the rest of the file
+			if (Pos > 0) {
+				Eof = !Fill(In, InLen, Pos) && Eof;
+			}
+			libdeflate_free_decompressor(Decompressor);
+			Decompressor = NULL;
+			InflateGzip(In, InLen, Eof);
+			return;
+		}
+	} catch (...) {
+		if (Decompressor != NULL) {
+			libdeflate_free_decompressor(Decompressor);
+		}
+		throw;
+	}
+
+	libdeflate_free_decompressor(Decompressor);
+}
+#endif
+
+//space for Len more bytes at the end of the pending buffer
+char* FastqReader::Reserve(size_t Len) {
+	size_t Used = Pending.size();
+	Pending.resize(Used + Len);
+	return &Pending[Used];
+}
+
+//keeps Len of the reserved bytes; tracks record boundaries and hands over full chunks
+void FastqReader::Commit(size_t Len) {
+
+	size_t Used = ScanPos + Len;
+	const char *Data = Pending.data(), *Newline;
+
+	Pending.resize(Used);
+
+	while (ScanPos < Used && (Newline = (const char*) memchr(Data + ScanPos, '\n', Used - ScanPos)) != NULL) {
+
+		ScanPos = Newline - Data;
+
+		if (ScanPos > LineStart && ++LinesInRecord == 4) { //non-empty line completes a record
+			RecordEnd = ScanPos + 1;
+			LinesInRecord = 0;
+		}
+
+		LineStart = ++ScanPos;
+	}
+
+	ScanPos = Used;
+
+	if (RecordEnd >= ChunkSize) {
+		Emit(false);
+	}
+
+}
+
+void FastqReader::Append(const char* Data, size_t Len) {
+	memcpy(Reserve(Len), Data, Len);
+	Commit(Len);
+}
+
+void FastqReader::Emit(bool Final) {
+
+	size_t Cut = Final ? Pending.size() : RecordEnd;
+	string Next(Pending, Cut); //partial record carried into the next chunk
+
+	if (Cut == 0) {
+		return;
+	}
+
+	Pending.resize(Cut);
+
+	if (Chunks.Push(make_shared<const string>(std::move(Pending))) == false) {
+		throw runtime_error("FASTQ reader stopped"); //reader closed early; ends this thread quietly
+	}
+
+	Pending.swap(Next);
+	Pending.reserve(ChunkSize + InflateStep);
+	ScanPos -= Cut;
+	LineStart -= Cut;
+	RecordEnd = 0;
+}
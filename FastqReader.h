@@ -0,0 +1,71 @@
+/*
+* Filename : FastqReader.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Reads FASTQ records from gzipped or plain files, pipes or stdin, decompressing on a dedicated thread.
+* Status: Release
+*/
+
+#ifndef FASTQREADER_H
+#define FASTQREADER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <atomic>
+#include <cstdint>
+#include "BoundedQueue.h"
+#include "StageTiming.h"
+
+using namespace std;
+
+typedef struct {
+	string_view Header; //full header line including '@'
+	string_view Seq;
+	string_view Qual;
+} FastqRecord; //views into a decompressed chunk
+
+class FastqReader {
+public:
+	explicit FastqReader(const string& Filename); //"-" reads stdin
+	~FastqReader();
+
+	bool is_open() const { return Descriptor >= 0; }
+	//returns records read; 0 at end of file; throws on decompression errors
+	//the chunks the records point into are appended to Buffers, which keeps them alive after later calls
+	size_t GetBatch(vector<FastqRecord>& Batch, size_t MaxRecords, vector<shared_ptr<const string>>& Buffers);
+	void AddDecompressTiming(StageTiming& Timing) const; //inflate time so far on the decompression thread
+
+private:
+	void Decompress();
+	void InflateGzip(vector<char>& In, size_t& InLen, bool& Eof);
+	void InflateMembers(vector<char>& In, size_t& InLen, bool& Eof); //libdeflate; falls back to InflateGzip
+	bool Fill(vector<char>& In, size_t& InLen, size_t Offset);
+	void Append(const char* Data, size_t Len);
+	char* Reserve(size_t Len);
+	void Commit(size_t Len);
+	void Emit(bool Final);
+	bool NextLine(const char*& Line, size_t& Len);
+
+	int Descriptor;
+	thread Decompressor;
+	exception_ptr Error;
+	BoundedQueue<shared_ptr<const string>> Chunks; //decompressed data cut at record boundaries
+
+	//decompression thread
+	string Pending;
+	size_t ScanPos, LineStart, RecordEnd;
+	unsigned LinesInRecord;
+	atomic<uint64_t> DecompressNanoseconds;
+	atomic<unsigned long> DecompressCalls;
+
+	//reading thread
+	shared_ptr<const string> Chunk;
+	size_t ChunkPos;
+	bool Finished;
+};
+
+#endif
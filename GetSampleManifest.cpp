@@ -0,0 +1,73 @@
+/*
+* Filename : GetSampleManifest.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Extract samples and their FASTQs from a batch manifest.
+* Status: Release
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <boost/algorithm/string.hpp>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+//OutputFilenamePrefix Read1.fastq[.gz] Read2.fastq[.gz] or OutputFilenamePrefix Interleaved.fastq[.gz]
+bool GetSampleManifest(ifstream& Manifest_in, vector<SampleFiles>& Samples) {
+
+	string ManifestLine;
+	vector<string> ManifestFields;
+	SampleFiles TempSample;
+	set<string> Prefixes;
+
+	if (!Manifest_in.is_open()) {
+		std::cerr << "ERROR: Unable to open sample manifest" << endl;
+		return 1;
+	}
+
+	while (Manifest_in.good()) {
+		getline(Manifest_in, ManifestLine);
+
+		boost::trim(ManifestLine);
+
+		//skip empty lines and headers
+		if (ManifestLine == "" || ManifestLine[0] == '#') {
+			continue;
+		}
+
+		boost::split(ManifestFields, ManifestLine, boost::is_any_of("\t "), boost::token_compress_on);
+
+		if (ManifestFields.size() != 2 && ManifestFields.size() != 3) {
+			std::cerr << "ERROR: Sample manifest improperly formatted." << endl;
+			std::cerr << "OutputFilenamePrefix Read1.fastq[.gz] Read2.fastq[.gz] or OutputFilenamePrefix Interleaved.fastq[.gz]" << endl;
+			return 1;
+		}
+
+		TempSample.Prefix = ManifestFields[0];
+		TempSample.R1FASTQ = ManifestFields[1];
+		TempSample.R2FASTQ = ManifestFields.size() == 3 ? ManifestFields[2] : ""; //interleaved
+
+		//samples run together so cannot share stdin or outputs
+		if (TempSample.R1FASTQ == "-" || TempSample.R2FASTQ == "-") {
+			std::cerr << "ERROR: " << TempSample.Prefix << " reads stdin; not supported in a sample manifest" << endl;
+			return 1;
+		}
+		if (Prefixes.insert(TempSample.Prefix).second == false) {
+			std::cerr << "ERROR: " << TempSample.Prefix << " appears more than once in the sample manifest" << endl;
+			return 1;
+		}
+
+		Samples.push_back(TempSample);
+	}
+
+	if (Samples.size() == 0) {
+		std::cerr << "ERROR: Sample manifest contains no samples" << endl;
+		return 1;
+	}
+
+	return 0;
+}
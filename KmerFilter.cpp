@@ -0,0 +1,113 @@
+/*
+* Filename : KmerFilter.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Rejects primer matched read pairs whose inserts share too few k-mers with the amplicon.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+MatchPrimer accepts 80% identity so mispriming from elsewhere in the genome still reaches clipping, merging and alignment
+before it is rejected. The k-mers of the amplicon on both strands are hashed into a bit table at panel load; every
+KmerFilterStride bases of each read's insert (after its primer, within the amplicon length) a k-mer is looked up.
+On-target inserts contain mostly amplicon k-mers even with sequencing errors and indels; off-target inserts only hit
+through table collisions (about 5%). Pairs are kept as soon as enough k-mers hit, so on-target pairs check few k-mers.
+*/
+
+static const unsigned KmerFilterK = 8, KmerFilterSlotBits = 13, KmerFilterStride = 4, KmerFilterMinSampled = 8;
+static const float KmerFilterMinContainment = 0.2;
+
+static inline unsigned KmerSlot(uint64_t Low, uint64_t High) { //k-mer codes as the packed planes hold them
+	return (unsigned) (((Low | High << KmerFilterK) * 0x9e3779b97f4a7c15ULL) >> (64 - KmerFilterSlotBits));
+}
+
+static void AddKmers(const string& Seq, vector<uint64_t>& Filter) {
+
+	const uint64_t Top = 1ULL << (KmerFilterK - 1);
+	uint64_t Low = 0, High = 0, Code;
+	unsigned Valid = 0, Slot;
+
+	for (unsigned n = 0; n < Seq.length(); ++n) {
+
+		switch (Seq[n]) {
+			case 'A': Code = 0; break;
+			case 'C': Code = 1; break;
+			case 'G': Code = 2; break;
+			case 'T': Code = 3; break;
+			default: Valid = 0; continue;
+		}
+
+		//first base of the k-mer in bit 0 as in PackedWindow
+		Low = Low >> 1 | ((Code & 1) ? Top : 0);
+		High = High >> 1 | ((Code & 2) ? Top : 0);
+
+		if (++Valid >= KmerFilterK) {
+			Slot = KmerSlot(Low, High);
+			Filter[Slot >> 6] |= 1ULL << (Slot & 63);
+		}
+	}
+
+}
+
+void BuildKmerFilter(const string& RefSeq, vector<uint64_t>& Filter) {
+
+	Filter.assign((1 << KmerFilterSlotBits) / 64, 0);
+
+	//R1 and R2 are looked up as sequenced so both strands are added
+	AddKmers(RefSeq, Filter);
+	AddKmers(ReverseComplement(RefSeq), Filter);
+}
+
+//sampled k-mers of Read between Start and End that are in the table; stops once Needed is reached
+static void CountKmers(const PackedSequence& Read, const unsigned Start, const unsigned End, const vector<uint64_t>& Filter,
+	const unsigned Needed, unsigned& Sampled, unsigned& Hits) {
+
+	const uint64_t Mask = (1ULL << KmerFilterK) - 1;
+	unsigned Slot;
+
+	for (unsigned n = Start; n + KmerFilterK <= End && Hits < Needed; n += KmerFilterStride) {
+
+		if ((PackedWindow(Read.NMask, n) & Mask) != 0) {
+			continue; //N or other base
+		}
+
+		Slot = KmerSlot(PackedWindow(Read.Low, n) & Mask, PackedWindow(Read.High, n) & Mask);
+
+		Sampled++;
+		Hits += Filter[Slot >> 6] >> (Slot & 63) & 1;
+	}
+
+}
+
+static unsigned KmerPositions(const unsigned Start, const unsigned End) {
+	return Start + KmerFilterK <= End ? (End - Start - KmerFilterK) / KmerFilterStride + 1 : 0;
+}
+
+bool isPairOffTarget(const PackedSequence& R1, const PackedSequence& R2, const AmpliconRecord& Amplicon) {
+
+	const unsigned RefLen = Amplicon.RefSeq.length();
+	unsigned R1End, R2End, Needed, Sampled = 0, Hits = 0;
+
+	//inserts lie between the primers; bases past the amplicon are adapter
+	R1End = min(min(R1.Length, PackedSequenceMaxBases), RefLen > Amplicon.RightPrimerLen ? RefLen - Amplicon.RightPrimerLen : 0);
+	R2End = min(min(R2.Length, PackedSequenceMaxBases), RefLen > Amplicon.LeftPrimerLen ? RefLen - Amplicon.LeftPrimerLen : 0);
+
+	Needed = (unsigned) (KmerFilterMinContainment * (KmerPositions(Amplicon.LeftPrimerLen, R1End) + KmerPositions(Amplicon.RightPrimerLen, R2End)) + 0.999f);
+
+	CountKmers(R1, Amplicon.LeftPrimerLen, R1End, Amplicon.KmerFilter, Needed, Sampled, Hits);
+	CountKmers(R2, Amplicon.RightPrimerLen, R2End, Amplicon.KmerFilter, Needed, Sampled, Hits);
+
+	if (Hits >= Needed || Sampled < KmerFilterMinSampled) {
+		return false; //too short or N rich inserts are left to the alignment
+	}
+
+	return Hits < KmerFilterMinContainment * Sampled;
+}
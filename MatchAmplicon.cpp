@@ -0,0 +1,87 @@
+/*
+* Filename : MatchAmplicon.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Finds the first amplicon whose left primer matches the start of a read using the primer seed index.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+static uint64_t MixSeed(uint64_t x) { //splitmix64 finaliser
+
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return x;
+}
+
+bool PrimerSeedKey(const PackedSequence& Seq, const PrimerSeedLayout& Layout, const unsigned Block, uint64_t& Key) {
+
+	const unsigned Start = Layout.BlockStarts[Block], Len = Layout.BlockLens[Block], Last = Layout.PrimerLen - 2;
+	const uint64_t Mask = (1ULL << Len) - 1;
+	uint64_t Low, High;
+
+	//seed cannot match an ACGT primer; last 2bp of the primer must match exactly
+	if ((PackedWindow(Seq.NMask, Start) & Mask) != 0 || (PackedWindow(Seq.NMask, Last) & 3) != 0) {
+		return false;
+	}
+
+	//block bases followed by the last 2bp; at most 31 bases in each plane
+	Low = (PackedWindow(Seq.Low, Start) & Mask) | (PackedWindow(Seq.Low, Last) & 3) << Len;
+	High = (PackedWindow(Seq.High, Start) & Mask) | (PackedWindow(Seq.High, Last) & 3) << Len;
+
+	Key = MixSeed(MixSeed(Low | High << 32) ^ ((uint64_t) Layout.PrimerLen << 32 | Block));
+
+	return true;
+}
+
+int MatchAmplicon(const PackedSequence& Seq, const vector<AmpliconRecord>& AmpliconRecords, const PrimerIndex& Index) {
+
+	unsigned Best = AmpliconRecords.size(), l, b, s, n;
+	uint64_t Key, Bucket;
+
+	//primers that are too short to seed
+	for (n = 0; n < Index.Unindexed.size() && Index.Unindexed[n] < Best; ++n) {
+		if (MatchPrimer(Seq, AmpliconRecords[Index.Unindexed[n]].LeftPrimerPacked) == 1) {
+			Best = Index.Unindexed[n];
+		}
+	}
+
+	for (l = 0; l < Index.Layouts.size(); ++l) {
+
+		const PrimerSeedLayout& Layout = Index.Layouts[l];
+
+		if (Layout.PrimerLen > Seq.Length) {
+			break; //layouts are sorted by length; a read shorter than the primer cannot match
+		}
+
+		for (b = 0; b < Layout.BlockStarts.size(); ++b) {
+
+			if (PrimerSeedKey(Seq, Layout, b, Key) == false) {
+				continue;
+			}
+
+			Bucket = Key & Index.BucketMask;
+
+			//verify candidates; the lowest matching amplicon wins as in a linear scan
+			for (s = Index.Buckets[Bucket]; s < Index.Buckets[Bucket + 1] && Index.SeedAmplicons[s] < Best; ++s) { //buckets are in amplicon order
+				if (Index.SeedKeys[s] == Key && MatchPrimer(Seq, AmpliconRecords[Index.SeedAmplicons[s]].LeftPrimerPacked) == 1) {
+					Best = Index.SeedAmplicons[s];
+				}
+			}
+
+		}
+
+	}
+
+	return Best < AmpliconRecords.size() ? (int) Best : -1;
+}
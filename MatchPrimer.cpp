@@ -6,25 +6,38 @@
 * Status: Release
 */
 
-#include <string>
+#include <cstdint>
+#include "AmpliconAlignerV2.h"
 
 using namespace std;
 
-bool MatchPrimer(const string& Seq, const string& Primer) //iterate over bases of primer and match to seq
+bool MatchPrimer(const PackedSequence& Seq, const PackedSequence& Primer) //compare 64 bases of primer and seq at a time
 {
-	float BasesMatched = 0;
-	unsigned MaxMismatchLen = 3, PrimerLen = Primer.length(); //no mismatches in the last 3bp -- prevents indels through phase shift and reduced off-target reads
+	float BasesMatched;
+	unsigned MaxMismatchLen = 3, PrimerLen = Primer.Length, MisMatches = 0; //no mismatches in the last 3bp -- prevents indels through phase shift and reduced off-target reads
+	uint64_t Diff;
 
-	for (unsigned base = 0; base < PrimerLen; ++base) {
+	if (Seq.Length < PrimerLen) {
+		return 0; //read is shorter than the primer
+	}
+
+	for (unsigned base = 0; base < PrimerLen; base += 64) {
+
+		Diff = PackedDifference(Seq, base, Primer, base);
 
-		if (Seq[base] == Primer[base]) {
-			BasesMatched++;
-		} else if (base > (PrimerLen - MaxMismatchLen)) {
-			return 0;
+		if (PrimerLen - base < 64) {
+			Diff &= (1ULL << (PrimerLen - base)) - 1;
 		}
 
+		MisMatches += __builtin_popcountll(Diff);
 	}
 
+	if (PrimerLen >= MaxMismatchLen && (PackedDifference(Seq, PrimerLen - 2, Primer, PrimerLen - 2) & 3) != 0) {
+		return 0;
+	}
+
+	BasesMatched = PrimerLen - MisMatches;
+
 	if (BasesMatched / (PrimerLen - MaxMismatchLen) > 0.8) { //check if match is acceptable
 		return 1;
 	}
@@ -0,0 +1,274 @@
+/*
+* Filename : MergeShards.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Combines the SAM/BAM and stats of a sample's shards into the files a single run would write.
+* Status: Release
+*/
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <zlib.h>
+#include "AmpliconAlignerV2.h"
+#include "BgzfStreamBuf.h"
+#include "SortedBamStreamBuf.h"
+#include "AsyncFileStreamBuf.h"
+
+using namespace std;
+
+/*									Method
+Each shard's Batch lines give the input pairs behind each run of its records. The runs of all shards are put in input
+order and must cover every pair once; as each shard's runs are already in order its records are read once, front to back,
+after its header. The header is taken from the shard holding the first pairs; it names that shard's command line.
+Counters are summed; wall time is the longest shard's.
+*/
+
+typedef struct {
+	unsigned Shard;
+	ShardBatch Batch;
+} TRun;
+
+static uint32_t GetLE32(const char* Data) {
+
+	uint32_t Value = 0;
+
+	for (unsigned b = 0; b < 4; ++b) {
+		Value |= (uint32_t) (unsigned char) Data[b] << (8 * b);
+	}
+
+	return Value;
+}
+
+//copies Bytes uncompressed bytes from Shard_in to Out; returns 1 on error
+static bool CopyShardBytes(gzFile Shard_in, uint64_t Bytes, ostream& Out, string& Buffer) {
+
+	int Read;
+
+	while (Bytes > 0) {
+
+		Read = gzread(Shard_in, &Buffer[0], (unsigned) min<uint64_t>(Bytes, Buffer.size()));
+
+		if (Read <= 0) {
+			return 1; //truncated shard
+		}
+
+		if (!Out.write(Buffer.data(), Read)) {
+			return 1;
+		}
+
+		Bytes -= Read;
+	}
+
+	return 0;
+}
+
+bool MergeShards(const string& Prefix, const vector<string>& ShardPrefixes, const AlignerParameters& Parameters, const unsigned Threads, const float Version) {
+
+	vector<ShardStats> Shards(ShardPrefixes.size());
+	vector<TRun> Runs;
+	vector<gzFile> Shards_in(ShardPrefixes.size(), (gzFile) NULL);
+	MappingStats Totals = MappingStats();
+	unsigned TotalReads = 0, HeaderShard = 0, MaxThreads = 0, s, n;
+	unsigned long InputPairs = 0, NextPair = 0;
+	bool InputEnded = false, Failed = false;
+	double WallSeconds = 0;
+	string Buffer(1 << 20, '\0'), Header, ShardHeader, Extension;
+	unique_ptr<BgzfStreamBuf> BAM_buf;
+	unique_ptr<SortedBamStreamBuf> SortedBAM_buf;
+	unique_ptr<AsyncFileStreamBuf> SAM_buf;
+	unique_ptr<ostream> Alignments_out;
+
+	for (s = 0; s < Shards.size(); ++s) {
+
+		if (ReadShardStats(ShardPrefixes[s] + "_ShardStats.txt", Shards[s]) == 1) {
+			return 1;
+		}
+
+		//shards must be of one sample, panel and version
+		if (Shards[s].Version != Version) {
+			std::cerr << "ERROR: " << ShardPrefixes[s] << " was written by AmpliconAligner v" << Shards[s].Version << endl;
+			return 1;
+		} else if (Shards[s].Format != Shards[0].Format || Shards[s].ReadGroup != Shards[0].ReadGroup || Shards[s].AmpliconIDs != Shards[0].AmpliconIDs) {
+			std::cerr << "ERROR: " << ShardPrefixes[s] << " does not have the output format, read group and amplicons of " << ShardPrefixes[0] << endl;
+			return 1;
+		}
+
+		//shards reading to the end of the input agree on its length
+		if (Shards[s].InputEnded) {
+			if (InputEnded && Shards[s].InputPairs != InputPairs) {
+				std::cerr << "ERROR: Shards were made from different FASTQs; " << ShardPrefixes[s] << " read " << Shards[s].InputPairs << " pairs" << endl;
+				return 1;
+			}
+			InputEnded = true;
+			InputPairs = Shards[s].InputPairs;
+		}
+
+		for (n = 0; n < Shards[s].Batches.size(); ++n) {
+			Runs.push_back(TRun{ s, Shards[s].Batches[n] });
+		}
+
+		//sum the counters
+		TotalReads += Shards[s].TotalReads;
+		AddMappingStats(Totals, Shards[s].Totals);
+
+		WallSeconds = max(WallSeconds, Shards[s].WallSeconds);
+		MaxThreads = max(MaxThreads, Shards[s].Threads);
+	}
+
+	if (!InputEnded) {
+		std::cerr << "ERROR: No shard read to the end of the FASTQs; the last read pairs may be missing" << endl;
+		return 1;
+	}
+
+	if (Parameters.SortOutput && Shards[0].Format != BamOutput) {
+		std::cerr << "ERROR: --sort requires BAM shards" << endl;
+		return 1;
+	}
+
+	//every pair in exactly one shard
+	stable_sort(Runs.begin(), Runs.end(), [](const TRun& a, const TRun& b) { return a.Batch.FirstPair < b.Batch.FirstPair; });
+
+	for (n = 0; n < Runs.size(); ++n) {
+
+		if (Runs[n].Batch.FirstPair != NextPair) {
+			std::cerr << "ERROR: Read pairs " << min(NextPair, Runs[n].Batch.FirstPair) + 1 << " to " << max(NextPair, Runs[n].Batch.FirstPair) <<
+				(Runs[n].Batch.FirstPair > NextPair ? " are in no shard" : " are in more than one shard") << endl;
+			return 1;
+		}
+
+		NextPair += Runs[n].Batch.Pairs;
+	}
+
+	if (NextPair != InputPairs) {
+		std::cerr << "ERROR: Read pairs " << NextPair + 1 << " to " << InputPairs << " are in no shard" << endl;
+		return 1;
+	}
+
+	if (!Runs.empty()) {
+		HeaderShard = Runs[0].Shard;
+	}
+
+	//open the shards; gzread also reads plain SAM
+	Extension = Shards[0].Format == BamOutput ? ".bam" : ".sam";
+
+	for (s = 0; s < Shards.size(); ++s) {
+
+		if ((Shards_in[s] = gzopen((ShardPrefixes[s] + Extension).c_str(), "rb")) == NULL) {
+			std::cerr << "ERROR: Unable to open " << ShardPrefixes[s] << Extension << endl;
+			Failed = true;
+			break;
+		}
+
+		gzbuffer(Shards_in[s], 1 << 17);
+
+		//headers differ only in the command line
+		ShardHeader.resize(Shards[s].HeaderBytes);
+		if (gzread(Shards_in[s], &ShardHeader[0], ShardHeader.size()) != (int) ShardHeader.size()) {
+			std::cerr << "ERROR: " << ShardPrefixes[s] << Extension << " is truncated" << endl;
+			Failed = true;
+			break;
+		}
+
+		if (s == HeaderShard) {
+			Header.swap(ShardHeader);
+		}
+	}
+
+	if (Failed == false) {
+
+		if (Shards[0].Format == BamOutput && Parameters.SortOutput) {
+
+			//BAM header: magic, l_text, text, n_ref
+			if (Header.size() < 12 || Header.size() < 12 + (size_t) GetLE32(&Header[4])) {
+				std::cerr << "ERROR: " << ShardPrefixes[HeaderShard] << Extension << " has no BAM header" << endl;
+				Failed = true;
+			} else {
+				SortedBAM_buf.reset(new SortedBamStreamBuf(Prefix + ".bam", Threads, GetLE32(&Header[8 + GetLE32(&Header[4])]), Parameters.SortMemory));
+				SortedBAM_buf->SetHeader(Header); //written when the records are sorted
+				Alignments_out.reset(new ostream(SortedBAM_buf.get()));
+				if (!SortedBAM_buf->is_open()) {
+					Alignments_out->setstate(ios_base::failbit);
+				}
+			}
+
+		} else if (Shards[0].Format == BamOutput) {
+
+			BAM_buf.reset(new BgzfStreamBuf(Prefix + ".bam", Threads));
+			Alignments_out.reset(new ostream(BAM_buf.get()));
+			if (!BAM_buf->is_open()) {
+				Alignments_out->setstate(ios_base::failbit);
+			}
+			Alignments_out->write(Header.data(), Header.size());
+			BAM_buf->FlushBlock(); //header in its own blocks
+
+		} else {
+			SAM_buf.reset(new AsyncFileStreamBuf(Prefix + ".sam"));
+			Alignments_out.reset(new ostream(SAM_buf.get()));
+			if (!SAM_buf->is_open()) {
+				Alignments_out->setstate(ios_base::failbit);
+			}
+			Alignments_out->write(Header.data(), Header.size());
+		}
+
+		//records in input order
+		for (n = 0; n < Runs.size() && Failed == false; ++n) {
+			if (CopyShardBytes(Shards_in[Runs[n].Shard], Runs[n].Batch.Bytes, *Alignments_out, Buffer) == 1) {
+				std::cerr << "ERROR: Could not copy records of " << ShardPrefixes[Runs[n].Shard] << Extension << " to " << Prefix << Extension << endl;
+				Failed = true;
+			}
+		}
+
+		if (Failed == false && !Alignments_out->good()) {
+			std::cerr << "ERROR: Could not write " << Prefix << Extension << ". Check file is not in use." << endl;
+			Failed = true;
+		}
+
+		if (SortedBAM_buf) {
+			if (SortedBAM_buf->close() == false && Failed == false) {
+				std::cerr << "ERROR: Could not write sorted BAM file or index. Check the files are not in use and there is space for " << Prefix << ".bam.tmp" << endl;
+				Failed = true;
+			}
+		} else if (BAM_buf) {
+			if (BAM_buf->close() == false && Failed == false) {
+				std::cerr << "ERROR: Could not write BAM file. Check file is not in use." << endl;
+				Failed = true;
+			}
+		} else if (SAM_buf) {
+			if (SAM_buf->close() == false && Failed == false) {
+				std::cerr << "ERROR: Could not write SAM file. Check file is not in use." << endl;
+				Failed = true;
+			}
+		}
+
+	}
+
+	for (s = 0; s < Shards_in.size(); ++s) {
+		if (Shards_in[s] != NULL) {
+			gzclose(Shards_in[s]);
+		}
+	}
+
+	if (Failed) {
+		return 1;
+	}
+
+	if (WriteMappingStats(Prefix + "_MappingStats.txt", Shards[HeaderShard].ReadGroup, Shards[HeaderShard].CommandLine, Version, TotalReads, Totals,
+		Shards[HeaderShard].AmpliconIDs) == 1) {
+		std::cerr << "ERROR: Could not write mapping stats file" << endl;
+		return 1;
+	}
+
+#ifndef NO_STAGE_TIMING
+	if (WriteStageTiming(Prefix + "_StageTiming.json", Totals, Shards[HeaderShard].AmpliconIDs, MaxThreads, WallSeconds) == 1) {
+		std::cerr << "ERROR: Could not write stage timing file" << endl;
+		return 1;
+	}
+#endif
+
+	return 0;
+}
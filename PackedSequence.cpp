@@ -0,0 +1,120 @@
+/*
+* Filename : PackedSequence.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Packs reads and primers two bits per base with an N mask and reverse complements the packed form.
+* Status: Release
+*/
+
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "PackedSequence.h"
+
+using namespace std;
+
+/*									Method
+Each base is one bit in three planes: the low and high bit of its code (A 0 C 1 G 2 T 3) and an N mask.
+A mismatch between two windows of 64 bases is an XOR and OR of the planes, and popcount gives the mismatch count.
+Complementing flips both code bits outside the N mask; reversing reverses the bit order of each plane.
+*/
+
+static const struct BaseCodeTable {
+	uint8_t Code[256]; //low bit, high bit, N mask; 8 if not ACGTN
+	BaseCodeTable() {
+		memset(Code, 4 | 8, sizeof(Code));
+		Code['A'] = 0;
+		Code['C'] = 1;
+		Code['G'] = 2;
+		Code['T'] = 3;
+		Code['N'] = 4;
+	}
+} BaseCodes;
+
+void PackSequence(string_view Seq, PackedSequence& Packed) {
+
+	const unsigned Len = min<size_t>(Seq.length(), PackedSequenceMaxBases);
+	unsigned n = 0;
+	uint64_t Other = 0;
+
+	memset(Packed.Low, 0, sizeof(Packed.Low));
+	memset(Packed.High, 0, sizeof(Packed.High));
+	memset(Packed.NMask, 0, sizeof(Packed.NMask));
+
+#ifdef __SSE2__
+	//16 bases per compare; movemask gives one bit per base for each plane
+	const __m128i A = _mm_set1_epi8('A'), C = _mm_set1_epi8('C'), G = _mm_set1_epi8('G'), T = _mm_set1_epi8('T'), N = _mm_set1_epi8('N');
+
+	for (; n + 16 <= Len; n += 16) {
+
+		__m128i Bases = _mm_loadu_si128((const __m128i*) (Seq.data() + n));
+		__m128i isC = _mm_cmpeq_epi8(Bases, C), isG = _mm_cmpeq_epi8(Bases, G), isT = _mm_cmpeq_epi8(Bases, T);
+		uint64_t ACGT = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(Bases, A), isC), _mm_or_si128(isG, isT)));
+
+		Packed.Low[n >> 6] |= (uint64_t) _mm_movemask_epi8(_mm_or_si128(isC, isT)) << (n & 63);
+		Packed.High[n >> 6] |= (uint64_t) _mm_movemask_epi8(_mm_or_si128(isG, isT)) << (n & 63);
+		Packed.NMask[n >> 6] |= (~ACGT & 0xffff) << (n & 63);
+		Other |= ~(ACGT | _mm_movemask_epi8(_mm_cmpeq_epi8(Bases, N))) & 0xffff;
+	}
+#endif
+
+	for (; n < Len; ++n) {
+
+		uint64_t Code = BaseCodes.Code[(unsigned char) Seq[n]];
+
+		Packed.Low[n >> 6] |= (Code & 1) << (n & 63);
+		Packed.High[n >> 6] |= (Code >> 1 & 1) << (n & 63);
+		Packed.NMask[n >> 6] |= (Code >> 2 & 1) << (n & 63);
+		Other |= Code & 8;
+	}
+
+	Packed.Length = Seq.length();
+	Packed.Exact = Other == 0 && Seq.length() <= PackedSequenceMaxBases;
+}
+
+static inline uint64_t ReverseBits(uint64_t x) {
+
+	x = (x >> 1 & 0x5555555555555555ULL) | (x & 0x5555555555555555ULL) << 1;
+	x = (x >> 2 & 0x3333333333333333ULL) | (x & 0x3333333333333333ULL) << 2;
+	x = (x >> 4 & 0x0f0f0f0f0f0f0f0fULL) | (x & 0x0f0f0f0f0f0f0f0fULL) << 4;
+
+	return __builtin_bswap64(x);
+}
+
+//reverse complement of the first Length packed bases of In
+void ReverseComplementPacked(const PackedSequence& In, const unsigned Length, PackedSequence& Out) {
+
+	int End, Start;
+	uint64_t Valid, N;
+
+	memset(Out.Low, 0, sizeof(Out.Low));
+	memset(Out.High, 0, sizeof(Out.High));
+	memset(Out.NMask, 0, sizeof(Out.NMask));
+
+	//output word w holds input bases End - 1 down to End - 64
+	for (unsigned w = 0; w * 64 < Length; ++w) {
+
+		End = Length - w * 64;
+		Start = End - 64;
+		Valid = End >= 64 ? ~0ULL : (1ULL << End) - 1;
+
+		if (Start >= 0) {
+			N = ReverseBits(PackedWindow(In.NMask, Start));
+			Out.Low[w] = (ReverseBits(PackedWindow(In.Low, Start)) ^ ~N) & Valid;
+			Out.High[w] = (ReverseBits(PackedWindow(In.High, Start)) ^ ~N) & Valid;
+		} else { //first bases of the input; shift them to the top before reversing
+			N = ReverseBits(In.NMask[0] << -Start);
+			Out.Low[w] = (ReverseBits(In.Low[0] << -Start) ^ ~N) & Valid;
+			Out.High[w] = (ReverseBits(In.High[0] << -Start) ^ ~N) & Valid;
+		}
+
+		Out.NMask[w] = N;
+	}
+
+	Out.Length = Length;
+	Out.Exact = In.Exact && Length <= In.Length;
+}
@@ -0,0 +1,42 @@
+/*
+* Filename : PackedSequence.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Reads packed two bits per base with a separate N mask, stored as bit planes of 64 bases per word.
+* Status: Release
+*/
+
+#ifndef PACKEDSEQUENCE_H
+#define PACKEDSEQUENCE_H
+
+#include <cstdint>
+#include <string_view>
+
+const unsigned PackedSequenceMaxBases = 512, PackedSequenceWords = PackedSequenceMaxBases / 64 + 1; //spare zero word for shifted windows
+
+typedef struct {
+	uint64_t Low[PackedSequenceWords]; //low bit of each base code; A 0 C 1 G 2 T 3
+	uint64_t High[PackedSequenceWords]; //high bit of each base code
+	uint64_t NMask[PackedSequenceWords]; //N and any other character; code bits are 0
+	unsigned Length; //bases in the sequence; only the first PackedSequenceMaxBases are packed
+	bool Exact; //false if truncated or a character other than ACGTN was packed as N
+} PackedSequence; //fixed size so per-thread copies never allocate
+
+//64 bases of a plane from Start; Start must be below PackedSequenceMaxBases
+inline uint64_t PackedWindow(const uint64_t* Plane, const unsigned Start) {
+
+	unsigned Word = Start >> 6, Shift = Start & 63;
+
+	return Shift == 0 ? Plane[Word] : Plane[Word] >> Shift | Plane[Word + 1] << (64 - Shift);
+}
+
+//bases that differ from Start1 and Start2 for 64 bases; N never matches a base but matches N
+inline uint64_t PackedDifference(const PackedSequence& Seq1, const unsigned Start1, const PackedSequence& Seq2, const unsigned Start2) {
+	return (PackedWindow(Seq1.Low, Start1) ^ PackedWindow(Seq2.Low, Start2)) | (PackedWindow(Seq1.High, Start1) ^ PackedWindow(Seq2.High, Start2)) |
+		(PackedWindow(Seq1.NMask, Start1) ^ PackedWindow(Seq2.NMask, Start2));
+}
+
+void PackSequence(std::string_view Seq, PackedSequence& Packed);
+void ReverseComplementPacked(const PackedSequence& In, const unsigned Length, PackedSequence& Out); //Length at most the packed bases of In
+
+#endif
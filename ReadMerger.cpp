@@ -7,13 +7,134 @@
 */
 
 #include <string>
+#include <string_view>
 #include <algorithm>
+#include <cstdint>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
 #include "AmpliconAlignerV2.h"
 
 using namespace std;
 
-bool ReadMerger(const string& SeqR1, const string& QualR1, string SeqR2, string QualR2,
-	const unsigned MaxQScore, const unsigned QScorePhredOffset, pair<string, string>& MergedRead) {
+//position of set bit Rank (0-based) in Bits
+static inline unsigned SelectBit(uint64_t Bits, unsigned Rank) {
+
+#ifdef __BMI2__
+	return __builtin_ctzll(_pdep_u64(1ULL << Rank, Bits));
+#else
+	for (; Rank > 0; --Rank) { //rank is at most the mismatch allowance
+		Bits &= Bits - 1;
+	}
+
+	return __builtin_ctzll(Bits);
+#endif
+}
+
+//score of R2 placed at ReadPos on R1; stops at the first mismatch over MaxMisMatches as the base by base loop does
+static int PackedOverlapScore(const PackedSequence& R1, const PackedSequence& R2, const unsigned ReadPos,
+	const unsigned Overlap, const unsigned MaxMisMatches, const int MatchAward, const int MismatchPenalty) {
+
+	unsigned Word, MisMatches = 0, Count;
+	uint64_t Diff;
+
+	for (Word = 0; Word * 64 < Overlap; ++Word) {
+
+		Diff = PackedDifference(R1, ReadPos + Word * 64, R2, Word * 64);
+
+		if (Overlap - Word * 64 < 64) {
+			Diff &= (1ULL << (Overlap - Word * 64)) - 1;
+		}
+
+		Count = __builtin_popcountll(Diff);
+
+		if (MisMatches + Count > MaxMisMatches) {
+
+			//position of the mismatch that ends the comparison
+			unsigned Compared = Word * 64 + SelectBit(Diff, MaxMisMatches - MisMatches) + 1;
+
+			return (int) (Compared - (MaxMisMatches + 1)) * MatchAward - (int) (MaxMisMatches + 1) * MismatchPenalty;
+		}
+
+		MisMatches += Count;
+	}
+
+	return (int) (Overlap - MisMatches) * MatchAward - (int) MisMatches * MismatchPenalty;
+}
+
+//consensus of Len overlapping bases; quality arithmetic as in the base by base merge including toascii
+static void MergeOverlap(const char* SeqR1, const char* QualR1, const char* SeqR2, const char* QualR2, const unsigned Len,
+	const unsigned MaxQScore, const unsigned QScorePhredOffset, char* Seq, char* Qual) {
+
+	unsigned n = 0;
+	int Q1, Q2;
+
+#ifdef __SSE4_1__
+	const __m128i Offset = _mm_set1_epi16(QScorePhredOffset), MaxQ = _mm_set1_epi16(MaxQScore), Ascii = _mm_set1_epi16(0x7f);
+
+	for (; n + 16 <= Len; n += 16) {
+
+		__m128i Base1 = _mm_loadu_si128((const __m128i*) (SeqR1 + n)), Base2 = _mm_loadu_si128((const __m128i*) (SeqR2 + n));
+		__m128i Qual1 = _mm_loadu_si128((const __m128i*) (QualR1 + n)), Qual2 = _mm_loadu_si128((const __m128i*) (QualR2 + n));
+		__m128i Same = _mm_cmpeq_epi8(Base1, Base2), Out[2], R2Wins[2];
+
+		for (unsigned h = 0; h < 2; ++h) {
+
+			__m128i Q1h = _mm_sub_epi16(_mm_cvtepi8_epi16(h == 0 ? Qual1 : _mm_srli_si128(Qual1, 8)), Offset);
+			__m128i Q2h = _mm_sub_epi16(_mm_cvtepi8_epi16(h == 0 ? Qual2 : _mm_srli_si128(Qual2, 8)), Offset);
+			__m128i Sameh = _mm_cvtepi8_epi16(h == 0 ? Same : _mm_srli_si128(Same, 8));
+
+			//match: sum capped at MaxQScore (an unsigned comparison, as in the scalar code); mismatch: difference
+			__m128i Q = _mm_blendv_epi8(_mm_abs_epi16(_mm_sub_epi16(Q1h, Q2h)), _mm_min_epu16(_mm_add_epi16(Q1h, Q2h), MaxQ), Sameh);
+
+			Out[h] = _mm_and_si128(_mm_add_epi16(Q, Offset), Ascii);
+			R2Wins[h] = _mm_cmpgt_epi16(Q2h, Q1h);
+		}
+
+		_mm_storeu_si128((__m128i*) (Seq + n), _mm_blendv_epi8(Base1, Base2, _mm_packs_epi16(R2Wins[0], R2Wins[1])));
+		_mm_storeu_si128((__m128i*) (Qual + n), _mm_packus_epi16(Out[0], Out[1]));
+	}
+#endif
+
+	for (; n < Len; ++n) {
+
+		Q1 = QualR1[n] - QScorePhredOffset;
+		Q2 = QualR2[n] - QScorePhredOffset;
+
+		if (SeqR1[n] == SeqR2[n]) { //base is the same; match
+			Seq[n] = SeqR1[n];
+
+			if (Q1 + Q2 > (int) MaxQScore) { //add quality Scores together; cap at 40
+				Qual[n] = toascii(MaxQScore + QScorePhredOffset);
+			} else {
+				Qual[n] = toascii(Q1 + Q2 + QScorePhredOffset);
+			}
+
+		} else { //bases not the same; mismatch
+
+			/*CLC BIO:If the two Scores of the input reads are approximately equal, the resulting Score will be very low which will reflect the fact that it is a very unreliable base.
+			On the other hand, if one Score is very low and the other is high, it is likely that the base with the high quality Score is indeed correct,
+			and this will be reflected in a relatively high quality Score.*/
+
+			if (Q1 >= Q2){ //R1 is more likely to be correct even if QScores are the same
+				Seq[n] = SeqR1[n]; //use highest scoring base
+				Qual[n] = toascii((Q1 - Q2) + QScorePhredOffset);
+			} else {
+				Seq[n] = SeqR2[n]; //use highest scoring base
+				Qual[n] = toascii((Q2 - Q1) + QScorePhredOffset);
+			}
+
+		}
+
+	}
+
+}
+
+bool ReadMerger(string_view SeqR1, string_view QualR1, string_view SeqR2, string_view QualR2, const PackedSequence& PackedR1, const PackedSequence& PackedR2,
+	const unsigned MaxQScore, const unsigned QScorePhredOffset, pair<string, string>& ReverseR2, pair<string, string>& MergedRead) {
 
 	/*									Method
 	R1 ---->	R1 ---->		B1 R1 ----> B2 R1 ---->  B3 R1 ---->   B4 R1 ---->
@@ -24,31 +145,58 @@ bool ReadMerger(const string& SeqR1, const string& QualR1, string SeqR2, string
 	unsigned MinScore = 15, MismatchPenalty = 4, MatchAward = 1; //use positive values
 	unsigned MisMatchDenominator = 20; //overlap length / MisMatchDenominatorless; than 5% MisMatches
 
-	unsigned ReadPos = 0, SeqR1Len = SeqR1.length(), SeqR2Len = SeqR2.length(), n, BestPos, MisMatches;
-	int Score, Q1, Q2, BestScore = 0, SecondBestScore = 0;
+	unsigned ReadPos = 0, SeqR1Len = SeqR1.length(), SeqR2Len = SeqR2.length(), n, BestPos = 0, MisMatches, Overlap;
+	int Score, BestScore = 0, SecondBestScore = 0;
+	PackedSequence ReversePackedR2;
 
 	//convert R2 orientation and complement
-	SeqR2 = ReverseComplement(SeqR2);
-	reverse(QualR2.begin(), QualR2.end());
+	ReverseComplement(SeqR2, ReverseR2.first);
+	ReverseR2.second.resize(QualR2.length());
+	reverse_copy(QualR2.begin(), QualR2.end(), ReverseR2.second.begin());
+	SeqR2 = ReverseR2.first;
+	QualR2 = ReverseR2.second;
+
+	//reads packed before clipping; reads with other characters or longer than PackedSequenceMaxBases are compared byte by byte
+	bool Packed = PackedR1.Exact && PackedR2.Exact;
+
+	if (Packed) {
+		ReverseComplementPacked(PackedR2, SeqR2Len, ReversePackedR2);
+	}
 
 	//match base by base reads and Score
 	while (ReadPos < SeqR1Len) { //iterate over SeqR1
-		Score = 0;
-		MisMatches = 0;
 
-		//Fix R1 in place, start R1 base 1 at R2 base 1, move R2 left to right one base at a time and check for matches/MisMatches against R1
+		if (Packed) {
 
-		for (n = 0; n + ReadPos < SeqR1Len && n < SeqR2Len; ++n) { //stop loop when SeqR2 (ReadPos) extends beyond the length of the SeqR1 OR get to the end of R2
+			Overlap = min(SeqR1Len - ReadPos, SeqR2Len);
 
-			if (SeqR1[n + ReadPos] == SeqR2[n]) {
-				Score += MatchAward;
-			} else {
-				Score -= MismatchPenalty;
-				MisMatches++;
+			if ((int) Overlap * (int) MatchAward <= BestScore) {
+				break; //overlaps only get shorter; no later offset can beat the best score
 			}
 
-			if (MisMatches > (float)((SeqR1Len - ReadPos) / MisMatchDenominator)) {  //length of potential overlap over maxmismatchdenominator
-				break; //stop checking if read exceeds maximum MisMatches for the whole overlap; improves preformance and accuracy
+			//each mismatch is an XOR of the planes; popcount gives the mismatches per 64 bases
+			Score = PackedOverlapScore(PackedR1, ReversePackedR2, ReadPos, Overlap, (SeqR1Len - ReadPos) / MisMatchDenominator, MatchAward, MismatchPenalty);
+
+		} else {
+
+			Score = 0;
+			MisMatches = 0;
+
+			//Fix R1 in place, start R1 base 1 at R2 base 1, move R2 left to right one base at a time and check for matches/MisMatches against R1
+
+			for (n = 0; n + ReadPos < SeqR1Len && n < SeqR2Len; ++n) { //stop loop when SeqR2 (ReadPos) extends beyond the length of the SeqR1 OR get to the end of R2
+
+				if (SeqR1[n + ReadPos] == SeqR2[n]) {
+					Score += MatchAward;
+				} else {
+					Score -= MismatchPenalty;
+					MisMatches++;
+				}
+
+				if (MisMatches > (float)((SeqR1Len - ReadPos) / MisMatchDenominator)) {  //length of potential overlap over maxmismatchdenominator
+					break; //stop checking if read exceeds maximum MisMatches for the whole overlap; improves preformance and accuracy
+				}
+
 			}
 
 		}
@@ -63,49 +211,21 @@ bool ReadMerger(const string& SeqR1, const string& QualR1, string SeqR2, string
 	}
 
 	//check best alignment & merge
-	if (BestScore > MinScore && (float) SecondBestScore / BestScore < 0.9 && SeqR2Len + BestPos >= SeqR1Len) {
+	if (BestScore > (int) MinScore && (float) SecondBestScore / BestScore < 0.9 && SeqR2Len + BestPos >= SeqR1Len) {
 		//Score is adequate, Score is sufficently higher than the second best & R1 does not have adapter
 
-		//attach start of SeqR1
-		MergedRead.first = SeqR1.substr(0, BestPos);
-		MergedRead.second = QualR1.substr(0, BestPos);
-
-		//take consensus across overlap
-		for (n = 0; n + BestPos < SeqR1Len; ++n) {
-
-			Q1 = QualR1[n + BestPos] - QScorePhredOffset;
-			Q2 = QualR2[n] - QScorePhredOffset;
-
-			if (SeqR1[n + BestPos] == SeqR2[n]) { //base is the same; match
-				MergedRead.first += SeqR1[n + BestPos];
-
-				if (Q1 + Q2 > MaxQScore) { //add quality Scores together; cap at 40
-					MergedRead.second += toascii(MaxQScore + QScorePhredOffset);
-				} else {
-					MergedRead.second += toascii(Q1 + Q2 + QScorePhredOffset);
-				}
-
-			} else { //bases not the same; mismatch
+		//attach start of SeqR1, consensus across the overlap and end of SeqR2
+		MergedRead.first.resize(BestPos + SeqR2Len);
+		MergedRead.second.resize(BestPos + QualR2.length());
 
-				/*CLC BIO:If the two Scores of the input reads are approximately equal, the resulting Score will be very low which will reflect the fact that it is a very unreliable base.
-				On the other hand, if one Score is very low and the other is high, it is likely that the base with the high quality Score is indeed correct,
-				and this will be reflected in a relatively high quality Score.*/
+		SeqR1.copy(&MergedRead.first[0], BestPos);
+		QualR1.copy(&MergedRead.second[0], BestPos);
 
-				if (Q1 >= Q2){ //R1 is more likely to be correct even if QScores are the same
-					MergedRead.first += SeqR1[n + BestPos]; //use highest scoring base
-					MergedRead.second += toascii((Q1 - Q2) + QScorePhredOffset); //
-				} else {
-					MergedRead.first += SeqR2[n]; //use highest scoring base
-					MergedRead.second += toascii((Q2 - Q1) + QScorePhredOffset);
-				}
-
-			}
-
-		}
+		MergeOverlap(&SeqR1[BestPos], &QualR1[BestPos], &SeqR2[0], &QualR2[0], SeqR1Len - BestPos, MaxQScore, QScorePhredOffset,
+			&MergedRead.first[BestPos], &MergedRead.second[BestPos]);
 
-		//attach end of SeqR2
-		MergedRead.first += SeqR2.substr(SeqR1Len - BestPos, string::npos);
-		MergedRead.second += QualR2.substr(SeqR1Len - BestPos, string::npos);
+		SeqR2.copy(&MergedRead.first[SeqR1Len], string::npos, SeqR1Len - BestPos);
+		QualR2.copy(&MergedRead.second[SeqR1Len], string::npos, SeqR1Len - BestPos);
 
 		return true;
 
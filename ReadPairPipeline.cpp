@@ -0,0 +1,330 @@
+/*
+* Filename : ReadPairPipeline.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Aligns batches of read pairs on a pool of worker threads and writes SAM records in input order.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <stdexcept>
+#include "AmpliconAlignerV2.h"
+#include "ReadPairPipeline.h"
+
+using namespace std;
+
+ReadPairPipeline::ReadPairPipeline(unsigned Threads, AlignerEngine& Engine) :
+	Threads(Threads < 1 ? 1 : Threads), Engine(Engine), AmpliconRecords(Engine.GetPanel().AmpliconRecords), Parameters(Engine.GetParameters()),
+	InputQueue(2 * Threads), OutputQueue(2 * Threads), MaxBatchesInFlight(4 * Threads), Failed(false) {
+
+	ThreadResults.resize(this->Threads);
+
+	//single thread runs inline on the reader thread
+	if (this->Threads > 1) {
+		for (unsigned t = 0; t < this->Threads; ++t) {
+			Workers.push_back(thread(&ReadPairPipeline::Worker, this, t));
+		}
+		WriterThread = thread(&ReadPairPipeline::Writer, this);
+	}
+
+}
+
+ReadPairPipeline::ReadPairPipeline(unsigned Threads, AlignerEngine& Engine, const string& ReadGroup, ostream& SAM_out) :
+	ReadPairPipeline(Threads, Engine) {
+	AddSample(ReadGroup, SAM_out);
+}
+
+ReadPairPipeline::~ReadPairPipeline() {
+	Join();
+}
+
+unsigned ReadPairPipeline::AddSample(const string& ReadGroup, ostream& SAM_out, vector<uint64_t>* BatchBytes) {
+
+	unique_ptr<PipelineSample> Sample(new PipelineSample());
+
+	Sample->ReadGroup = &ReadGroup;
+	Sample->SAM_out = &SAM_out;
+	Sample->BatchBytes = BatchBytes;
+	Sample->AlignmentCaches = vector<AlignmentCache>(AmpliconRecords.size());
+	Sample->ThreadStats.resize(Threads);
+	Sample->BatchesSubmitted = 0;
+	Sample->BatchesWritten = 0;
+
+	for (unsigned t = 0; t < Threads; ++t) {
+		Sample->ThreadStats[t] = MappingStats();
+		Sample->ThreadStats[t].AmpliconStats.resize(AmpliconRecords.size(), Stat());
+	}
+
+	lock_guard<mutex> Lock(SamplesMutex);
+	Samples.push_back(std::move(Sample));
+
+	return Samples.size() - 1;
+}
+
+ReadPairPipeline::PipelineSample& ReadPairPipeline::GetSample(unsigned Sample) {
+
+	lock_guard<mutex> Lock(SamplesMutex);
+
+	if (Sample >= Samples.size() || !Samples[Sample]) {
+		throw logic_error("Read pair pipeline sample is not open");
+	}
+
+	return *Samples[Sample];
+}
+
+void ReadPairPipeline::Submit(unsigned SampleNo, ReadPairBatch& Batch) {
+
+	PipelineSample& Sample = GetSample(SampleNo);
+
+	if (Threads == 1) {
+
+		SamRecords.clear();
+		AlignBatch(Sample, Batch, ThreadResults[0], Sample.ThreadStats[0], SamRecords);
+		WriteSamRecords(Sample, SamRecords);
+		Batch.Pairs.clear();
+		Batch.Buffers.clear();
+		return;
+	}
+
+	//limit the number of batches waiting to be written so a slow batch cannot queue unbounded output
+	{
+		unique_lock<mutex> Lock(WindowMutex);
+		WindowChanged.wait(Lock, [this, &Sample] { return Sample.BatchesSubmitted - Sample.BatchesWritten < MaxBatchesInFlight || Failed; });
+	}
+
+	if (Failed || InputQueue.Push(TBatch{ &Sample, Sample.BatchesSubmitted, std::move(Batch) }) == false) {
+		Join();
+		RethrowError();
+	}
+
+	{
+		lock_guard<mutex> Lock(WindowMutex);
+		Sample.BatchesSubmitted++;
+	}
+
+	Batch.Pairs.clear();
+	Batch.Buffers.clear();
+}
+
+void ReadPairPipeline::FlushSample(unsigned SampleNo, MappingStats& Stats) {
+
+	PipelineSample& Sample = GetSample(SampleNo);
+
+	if (Threads > 1) {
+		unique_lock<mutex> Lock(WindowMutex);
+		WindowChanged.wait(Lock, [this, &Sample] { return Sample.BatchesWritten == Sample.BatchesSubmitted || Failed; });
+	}
+
+	//workers may still hold the sample's batches
+	if (Failed) {
+		Join();
+		RethrowError();
+	}
+
+	//merge per-thread counters; no batch of the sample is in flight so the workers do not touch them
+	Stats = MappingStats();
+	Stats.AmpliconStats.resize(AmpliconRecords.size(), Stat());
+
+	for (unsigned t = 0; t < Threads; ++t) {
+		AddMappingStats(Stats, Sample.ThreadStats[t]);
+		Sample.ThreadStats[t] = MappingStats();
+		Sample.ThreadStats[t].AmpliconStats.resize(AmpliconRecords.size(), Stat());
+	}
+
+}
+
+void ReadPairPipeline::FinishSample(unsigned SampleNo, MappingStats& Stats) {
+
+	FlushSample(SampleNo, Stats);
+
+	//free the sample's alignment cache
+	lock_guard<mutex> Lock(SamplesMutex);
+	Samples[SampleNo].reset();
+}
+
+void ReadPairPipeline::Submit(ReadPairBatch& Batch) {
+	Submit(0, Batch);
+}
+
+void ReadPairPipeline::Finish(MappingStats& Stats) {
+
+	FinishSample(0, Stats);
+	Join();
+
+	if (Error) {
+		rethrow_exception(Error);
+	}
+}
+
+void ReadPairPipeline::Worker(unsigned ThreadNo) {
+
+	TBatch Batch;
+
+	try {
+		while (!Failed && InputQueue.Pop(Batch)) {
+
+			PipelineSample& Sample = *Batch.Sample;
+			TSamBatch SamBatch{ Batch.Sample, Batch.BatchNo, string() };
+
+			//reuse a written buffer; already grown to a batch of records
+			{
+				lock_guard<mutex> Lock(SpareMutex);
+				if (!SpareBuffers.empty()) {
+					SamBatch.SamRecords.swap(SpareBuffers.back());
+					SpareBuffers.pop_back();
+				}
+			}
+
+			AlignBatch(Sample, Batch.Reads, ThreadResults[ThreadNo], Sample.ThreadStats[ThreadNo], SamBatch.SamRecords);
+
+			if (OutputQueue.Push(std::move(SamBatch)) == false) {
+				return;
+			}
+		}
+	} catch (...) {
+		Fail(current_exception());
+	}
+
+}
+
+void ReadPairPipeline::Writer() {
+
+	TSamBatch SamBatch;
+
+	try {
+		while (!Failed && OutputQueue.Pop(SamBatch)) {
+
+			PipelineSample& Sample = *SamBatch.Sample;
+			map<unsigned long, string>& Pending = Sample.Pending;
+
+			Pending[SamBatch.BatchNo].swap(SamBatch.SamRecords);
+
+			//write all of the sample's batches that are now in order
+			for (auto it = Pending.find(Sample.BatchesWritten); it != Pending.end(); ) {
+				WriteSamRecords(Sample, it->second); //one write per batch
+
+				{
+					lock_guard<mutex> Lock(SpareMutex);
+					SpareBuffers.push_back(string());
+					SpareBuffers.back().swap(it->second);
+					SpareBuffers.back().clear();
+				}
+
+				Pending.erase(it);
+				it = Pending.find(Sample.BatchesWritten + 1);
+
+				//once its last batch is counted the sample may be finished and freed, so it is not touched again
+				const bool More = it != Pending.end();
+
+				{
+					lock_guard<mutex> Lock(WindowMutex);
+					Sample.BatchesWritten++;
+				}
+				WindowChanged.notify_all(); //readers of all samples wait on the one condition
+
+				if (!More) {
+					break;
+				}
+			}
+		}
+	} catch (...) {
+		Fail(current_exception());
+	}
+
+}
+
+//the engine aligns the batch with the sample's cache; mapped pairs are appended to SamRecords in input order
+void ReadPairPipeline::AlignBatch(PipelineSample& Sample, ReadPairBatch& Reads, vector<PairAlignment>& Results, MappingStats& Stats, string& SamRecords) {
+
+	Engine.AlignBatch(Reads.Pairs, Sample.AlignmentCaches, Results, Stats);
+
+	for (unsigned n = 0; n < Reads.Pairs.size(); ++n) {
+		if (Results[n].Outcome == PairMapped) {
+			uint64_t Start = StageClock();
+			AppendPairRecord(SamRecords, Reads.Pairs[n], Results[n], AmpliconRecords, Parameters, *Sample.ReadGroup);
+			EndStage(Stats.Timing, StageFormat, Start);
+		}
+	}
+
+}
+
+void ReadPairPipeline::WriteSamRecords(PipelineSample& Sample, const string& SamRecords) {
+
+	ostream& SAM_out = *Sample.SAM_out;
+
+	if (Sample.BatchBytes != NULL) {
+		Sample.BatchBytes->push_back(SamRecords.size()); //empty batches too
+	}
+
+	if (SamRecords.empty()) {
+		return;
+	}
+
+	if (!SAM_out.good()) {
+		throw runtime_error("Could not ouput Alignments to SAM file. Check file is not in use.");
+	}
+
+	SAM_out.write(SamRecords.data(), SamRecords.size());
+
+	if (!SAM_out.good()) {
+		throw runtime_error("Could not ouput Alignments to SAM file. Check file is not in use.");
+	}
+}
+
+void ReadPairPipeline::Fail(exception_ptr WorkerError) {
+
+	{
+		lock_guard<mutex> Lock(ErrorMutex);
+		if (!Error) {
+			Error = WorkerError;
+		}
+	}
+
+	{
+		lock_guard<mutex> Lock(WindowMutex);
+		Failed = true;
+	}
+
+	WindowChanged.notify_all();
+	InputQueue.Close();
+	OutputQueue.Close();
+}
+
+//the queues are also closed by Join without a worker error, e.g. on Submit after Finish
+void ReadPairPipeline::RethrowError() {
+
+	exception_ptr WorkerError;
+
+	{
+		lock_guard<mutex> Lock(ErrorMutex);
+		WorkerError = Error;
+	}
+
+	if (!WorkerError) {
+		throw logic_error("Read pair pipeline has been stopped");
+	}
+
+	rethrow_exception(WorkerError);
+}
+
+void ReadPairPipeline::Join() {
+
+	lock_guard<mutex> Lock(JoinMutex); //reader threads of failed samples may join together
+
+	InputQueue.Close();
+	OutputQueue.Close();
+
+	for (unsigned t = 0; t < Workers.size(); ++t) {
+		if (Workers[t].joinable()) {
+			Workers[t].join();
+		}
+	}
+
+	if (WriterThread.joinable()) {
+		WriterThread.join();
+	}
+
+}
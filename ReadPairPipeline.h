@@ -0,0 +1,109 @@
+/*
+* Filename : ReadPairPipeline.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Aligns batches of read pairs on a pool of worker threads and writes SAM records in input order; samples can share the pool.
+* Status: Release
+*/
+
+#ifndef READPAIRPIPELINE_H
+#define READPAIRPIPELINE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <condition_variable>
+#include "AmpliconAlignerV2.h"
+#include "AlignerEngine.h"
+#include "BoundedQueue.h"
+
+typedef struct {
+	vector<ReadPair> Pairs;
+	vector<shared_ptr<const string>> Buffers; //input chunks the pairs point into; released with the batch
+} ReadPairBatch;
+
+class ReadPairPipeline {
+public:
+	//pool shared by the samples added with AddSample; batches are aligned by Engine, which must have its panel loaded
+	ReadPairPipeline(unsigned Threads, AlignerEngine& Engine);
+	//single sample; ReadGroup is read by the workers and must be set before the first batch is submitted
+	ReadPairPipeline(unsigned Threads, AlignerEngine& Engine, const string& ReadGroup, ostream& SAM_out);
+	~ReadPairPipeline();
+
+	//ReadGroup and SAM_out are used until FinishSample returns; ReadGroup must be set before the first batch is submitted
+	//samples may be fed from different threads, one thread per sample; with one worker thread they must be fed in turn
+	//BatchBytes, if given, gets the bytes written for each batch in submission order; complete when FinishSample returns
+	unsigned AddSample(const string& ReadGroup, ostream& SAM_out, vector<uint64_t>* BatchBytes = NULL);
+	void Submit(unsigned Sample, ReadPairBatch& Batch); //takes the contents of Batch; rethrows worker errors
+	void FinishSample(unsigned Sample, MappingStats& Stats); //waits for the sample's batches to be written and merges its per-thread stats
+	void FlushSample(unsigned Sample, MappingStats& Stats); //as FinishSample but keeps the sample open; Stats covers the batches since the last flush
+
+	void Submit(ReadPairBatch& Batch); //single sample
+	void Finish(MappingStats& Stats); //finishes the single sample and stops the pool
+
+private:
+	typedef struct {
+		const string* ReadGroup;
+		ostream* SAM_out; //SAM text or BGZF compressed BAM
+		vector<uint64_t>* BatchBytes; //NULL unless sharded
+		vector<AlignmentCache> AlignmentCaches; //by amplicon; never resized as it holds mutexes
+		vector<MappingStats> ThreadStats;
+		map<unsigned long, string> Pending; //batches completed out of order; writer thread only
+		unsigned long BatchesSubmitted, BatchesWritten;
+	} PipelineSample;
+
+	typedef struct {
+		PipelineSample* Sample;
+		unsigned long BatchNo;
+		ReadPairBatch Reads;
+	} TBatch;
+
+	typedef struct {
+		PipelineSample* Sample;
+		unsigned long BatchNo;
+		string SamRecords;
+	} TSamBatch;
+
+	PipelineSample& GetSample(unsigned Sample);
+	void Worker(unsigned ThreadNo);
+	void Writer();
+	void AlignBatch(PipelineSample& Sample, ReadPairBatch& Reads, vector<PairAlignment>& Results, MappingStats& Stats, string& SamRecords);
+	void WriteSamRecords(PipelineSample& Sample, const string& SamRecords);
+	void Fail(exception_ptr Error);
+	void RethrowError(); //worker error, or logic_error if the pipeline was stopped without one
+	void Join(); //closes the queues and waits for all threads
+
+	unsigned Threads;
+	AlignerEngine& Engine;
+	const vector<AmpliconRecord>& AmpliconRecords;
+	const AlignerParameters& Parameters;
+
+	vector<unique_ptr<PipelineSample>> Samples; //released when finished
+	mutex SamplesMutex;
+
+	vector<vector<PairAlignment>> ThreadResults; //reused by each thread's batches
+	vector<thread> Workers;
+	thread WriterThread;
+	BoundedQueue<TBatch> InputQueue;
+	BoundedQueue<TSamBatch> OutputQueue;
+	string SamRecords; //single thread buffer
+	vector<string> SpareBuffers; //written output buffers returned for reuse by the workers
+	mutex SpareMutex;
+
+	unsigned long MaxBatchesInFlight; //per sample
+	mutex WindowMutex;
+	condition_variable WindowChanged;
+
+	atomic<bool> Failed;
+	exception_ptr Error;
+	mutex ErrorMutex;
+	mutex JoinMutex;
+};
+
+#endif
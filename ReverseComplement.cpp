@@ -7,6 +7,11 @@
 */
 
 #include <string>
+#include <string_view>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include "AmpliconAlignerV2.h"
 
 using namespace std;
 
@@ -14,29 +19,53 @@ string ReverseComplement(const string& DNA) {
 
 	string revcomp;
 
-	for (short n = (DNA.length() - 1); n > -1; --n) {
-
-		if (DNA[n] == 'A') {
-			revcomp += 'T';
-		} else if (DNA[n] == 'T') {
-			revcomp += 'A';
-		} else if (DNA[n] == 'G') {
-			revcomp += 'C';
-		} else if (DNA[n] == 'C') {
-			revcomp += 'G';
-		} else if (DNA[n] == 'a') {
-			revcomp += 't';
-		} else if (DNA[n] == 't') {
-			revcomp += 'a';
-		} else if (DNA[n] == 'g') {
-			revcomp += 'c';
-		} else if (DNA[n] == 'c') {
-			revcomp += 'g';
-		} else {
-			revcomp += DNA[n];
+	ReverseComplement(DNA, revcomp);
+
+	return revcomp;
+}
+
+void ReverseComplement(string_view DNA, string& revcomp) { //writes into a reused buffer
+
+	static const struct ComplementTable {
+		char Base[256];
+		ComplementTable() {
+			for (unsigned c = 0; c < 256; ++c) {
+				Base[c] = (char) c; //other characters are kept
+			}
+			Base['A'] = 'T';
+			Base['T'] = 'A';
+			Base['G'] = 'C';
+			Base['C'] = 'G';
+			Base['a'] = 't';
+			Base['t'] = 'a';
+			Base['g'] = 'c';
+			Base['c'] = 'g';
 		}
+	} Complement;
+
+	size_t n = 0;
+
+	revcomp.resize(DNA.length());
 
+#ifdef __SSSE3__
+	//16 bases per shuffle; A<->T and C<->G differ by one XOR in either case
+	const __m128i Reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0), Lower = _mm_set1_epi8(0x20);
+	const __m128i SwapAT = _mm_set1_epi8('A' ^ 'T'), SwapCG = _mm_set1_epi8('C' ^ 'G');
+
+	for (; n + 16 <= DNA.length(); n += 16) {
+
+		__m128i Bases = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (DNA.data() + DNA.length() - 16 - n)), Reverse);
+		__m128i Folded = _mm_or_si128(Bases, Lower);
+		__m128i isAT = _mm_or_si128(_mm_cmpeq_epi8(Folded, _mm_set1_epi8('a')), _mm_cmpeq_epi8(Folded, _mm_set1_epi8('t')));
+		__m128i isCG = _mm_or_si128(_mm_cmpeq_epi8(Folded, _mm_set1_epi8('c')), _mm_cmpeq_epi8(Folded, _mm_set1_epi8('g')));
+
+		Bases = _mm_xor_si128(Bases, _mm_or_si128(_mm_and_si128(isAT, SwapAT), _mm_and_si128(isCG, SwapCG)));
+		_mm_storeu_si128((__m128i*) &revcomp[n], Bases);
+	}
+#endif
+
+	for (; n < DNA.length(); ++n) {
+		revcomp[n] = Complement.Base[(unsigned char) DNA[DNA.length() - 1 - n]];
 	}
 
-	return revcomp;
 }
\ No newline at end of file
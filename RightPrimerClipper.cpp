@@ -1,31 +1,149 @@
 /*
-* FiLename : MatchPrimer.cpp
+* FiLename : RightPrimerClipper.cpp
 * Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
 * Contact : mlyon@live.co.uk
-* Description : Uses Smith-Waterman (SeqAn) local alignement to identify supplied Primer Sequences within the read and clip Sequence beyond this point
+* Description : Uses Smith-Waterman local alignement against a precomputed primer profile to identify supplied Primer Sequences within the read and clip Sequence beyond this point
 * Status: Release
 */
 
 #include <string>
-#include <seqan/align.h>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "AmpliconAlignerV2.h"
 
 using namespace std;
 
-void RightPrimerClipper(string& Seq, string& Qual, string Primer) //clip after right Primer Sequence
-{
-	ReverseComplement(Primer);
+/*									Method
+Local alignment of the primer within the read scoring match 1, mismatch -2 and -4 per gap base (as seqan::Score<int>(1, -2, -4)).
+The read is scanned once; each read base updates the column of primer scores using the profile row for that base, 16 primer
+positions per instruction with a lazy pass for vertical gaps (Farrar). Columns are visited in read order and only a strictly
+higher score moves the end, so the clip position is the first read position reaching the best score, as seqan reports it.
+*/
+
+static const unsigned MinClipScore = 10, GapScore = 4, Lanes = 16, MaxSegments = (ClipProfileMaxPrimerLen + Lanes - 1) / Lanes;
+
+static const struct ReadCodeTable {
+	uint8_t Code[256]; //profile row: A 0, C 1, G 2, T 3, anything else 4
+	ReadCodeTable() {
+		memset(Code, 4, sizeof(Code));
+		Code['A'] = 0;
+		Code['C'] = 1;
+		Code['G'] = 2;
+		Code['T'] = 3;
+	}
+} ReadCodes;
+
+//best local alignment score of the primer in Seq and the read position after its first occurrence
+static unsigned LocalAlignmentEnd(string_view Seq, const ClipProfile& Primer, unsigned& End) {
+
+	unsigned Best = 0, i;
+
+	End = 0;
+
+	if (Primer.Segments == 0) {
+		return 0;
+	}
+
+#ifdef __SSE2__
+	const __m128i Zero = _mm_setzero_si128(), Gap = _mm_set1_epi8(GapScore), Bias = _mm_set1_epi8(2);
+	__m128i Columns[2][MaxSegments], *Store = Columns[0], *Load = Columns[1], H, F, Max, BestScore = Zero;
+	unsigned s;
+
+	for (s = 0; s < Primer.Segments; ++s) {
+		Store[s] = Zero;
+	}
+
+	for (i = 0; i < Seq.length(); ++i) {
+
+		const uint8_t* Profile = &Primer.Scores[ReadCodes.Code[(unsigned char) Seq[i]] * Primer.Segments * Lanes];
+
+		F = Zero;
+		Max = Zero;
+		H = _mm_slli_si128(Store[Primer.Segments - 1], 1); //diagonal predecessors of segment 0
+		swap(Store, Load);
+
+		for (s = 0; s < Primer.Segments; ++s) {
+			H = _mm_subs_epu8(_mm_adds_epu8(H, _mm_loadu_si128((const __m128i*) (Profile + s * Lanes))), Bias);
+			H = _mm_max_epu8(H, _mm_subs_epu8(Load[s], Gap)); //gap in the primer
+			H = _mm_max_epu8(H, F); //gap in the read
+			Max = _mm_max_epu8(Max, H);
+			Store[s] = H;
+			F = _mm_subs_epu8(H, Gap);
+			H = Load[s];
+		}
+
+		//carry read gaps across segment boundaries until they no longer raise a score
+		F = _mm_slli_si128(F, 1);
+		s = 0;
+
+		while (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(F, Store[s]), Zero)) != 0xffff) {
+
+			Store[s] = _mm_max_epu8(Store[s], F);
+			Max = _mm_max_epu8(Max, Store[s]);
+			F = _mm_subs_epu8(Store[s], Gap);
 
-	seqan::Align< seqan::String<char> > alignment;
-	seqan::resize(rows(alignment), 2); //pairwise
-	seqan::assignSource(row(alignment, 0), Seq);
-	seqan::assignSource(row(alignment, 1), Primer);
+			if (++s == Primer.Segments) {
+				F = _mm_slli_si128(F, 1);
+				s = 0;
+			}
+
+		}
+
+		//new best score in this column
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(Max, BestScore), Zero)) != 0xffff) {
+			Max = _mm_max_epu8(Max, _mm_srli_si128(Max, 8));
+			Max = _mm_max_epu8(Max, _mm_srli_si128(Max, 4));
+			Max = _mm_max_epu8(Max, _mm_srli_si128(Max, 2));
+			Max = _mm_max_epu8(Max, _mm_srli_si128(Max, 1));
+			Best = _mm_cvtsi128_si32(Max) & 0xff;
+			BestScore = _mm_set1_epi8(Best);
+			End = i + 1;
+		}
+
+	}
+#else
+	int Column[ClipProfileMaxPrimerLen + 1] = {0}, Diagonal, Up, Score;
+	unsigned j;
+
+	for (i = 0; i < Seq.length(); ++i) {
+
+		Diagonal = 0;
+		Up = 0;
+
+		for (j = 1; j <= Primer.Primer.length(); ++j) {
+
+			Score = max(0, max(Diagonal + (Seq[i] == Primer.Primer[j - 1] ? 1 : -2), max(Column[j], Up) - (int) GapScore));
+			Diagonal = Column[j];
+			Column[j] = Score;
+			Up = Score;
+
+			if ((unsigned) Score > Best) {
+				Best = Score;
+				End = i + 1;
+			}
+
+		}
+
+	}
+#endif
+
+	return Best;
+}
+
+void RightPrimerClipper(string_view& Seq, string_view& Qual, const ClipProfile& Primer) //clip after right Primer Sequence
+{
+	unsigned End;
 
 	//Match misMatch gap open gap extend
-	if (seqan::localAlignment(alignment, seqan::Score<int>(1, -2, -4)) >= 10){ //clip by right Primer
+	if (LocalAlignmentEnd(Seq, Primer, End) >= MinClipScore){ //clip by right Primer
 
-		Seq = Seq.substr(0, seqan::clippedEndPosition(row(alignment, 0)));
-		Qual = Qual.substr(0, seqan::clippedEndPosition(row(alignment, 0)));
+		Seq = Seq.substr(0, End);
+		Qual = Qual.substr(0, End);
 
 	}
 
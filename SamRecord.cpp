@@ -0,0 +1,70 @@
+/*
+* Filename : SamRecord.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Formats the SAM header and SAM alignment records from fields prebuilt for each amplicon.
+* Status: Release
+*/
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <sstream>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+//panel headers then the sample's read group and program lines
+void AppendSamHeader(string& Out, const vector<string>& SamHeaders, const string& ReadGroup, const string& Sample, const string& CommandLine, const float Version) {
+
+	ostringstream HeaderText;
+
+	for (unsigned n = 0; n < SamHeaders.size(); ++n) {
+		HeaderText << SamHeaders[n] << "\012";
+	}
+
+	HeaderText << "@RG\tID:" << ReadGroup << "\tSM:" << Sample << "\tPL:ILLUMINA\tLB:" << Sample << "\012";
+	HeaderText << "@PG\tID:IndelAmpliconAligner\tPN:IndelAmpliconAligner\tCL:" << CommandLine;
+	HeaderText << "\tVN:" << Version << "\012";
+	HeaderText << "@CO\tReads were globally Aligned using amplicon specific reference sequences\012";
+
+	Out += HeaderText.str();
+}
+
+//fields that are the same for every read of the amplicon
+void BuildSamFields(AmpliconRecord& Amplicon) {
+
+	Amplicon.SamPrefix = Amplicon.Strand == true ? "\t0\t" : "\t16\t"; //read was reverse ConvertDNAComplemented
+	Amplicon.SamPrefix += Amplicon.Chrom;
+	Amplicon.SamPrefix += '\t';
+	AppendNumber(Amplicon.SamPrefix, Amplicon.Pos);
+	Amplicon.SamPrefix += '\t';
+
+	Amplicon.SamSuffix = "\tCO:Z:";
+	Amplicon.SamSuffix += Amplicon.ID; //amplicon name
+	Amplicon.SamSuffix += '\012';
+}
+
+void AppendSamRecord(string& Out, string_view ReadName, const AmpliconRecord& Amplicon, const unsigned MapQ, const vector<uint32_t>& Cigar,
+	const string& Seq, const string& Qual, const string& ReadGroup, const unsigned NM, const int AS) {
+
+	Out += ReadName;
+	Out += Amplicon.SamPrefix; //flag, chromosome and position
+	AppendNumber(Out, MapQ);
+	Out += '\t';
+	AppendCigar(Out, Cigar);
+	Out += "\t*\t0\t0\t";
+	Out += Seq;
+	Out += '\t';
+	Out += Qual;
+
+	//optional fields
+	Out += "\tRG:Z:";
+	Out += ReadGroup;
+	Out += "\tNM:i:";
+	AppendNumber(Out, NM); //edit distance- including every base of an indel
+	Out += "\tAS:i:";
+	AppendNumber(Out, AS); //true alignment score
+	Out += Amplicon.SamSuffix;
+}
@@ -0,0 +1,222 @@
+/*
+* Filename : ShardStats.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Writes and reads the machine readable partial stats of one shard of a sample or one server batch.
+* Status: Release
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+One tab delimited key and value(s) per line. Counters are unreduced so shards can be summed; Batch lines give the input
+pairs behind each run of output records so MergeShards can put the shards' records back in input order.
+*/
+
+static const char* ShardStatsHeader = "#AmpliconAligner shard stats";
+
+bool WriteShardStats(ostream& Shard_out, const ShardStats& Shard) {
+
+	const MappingStats& Totals = Shard.Totals;
+	unsigned n;
+
+	Shard_out << ShardStatsHeader << "\n";
+	Shard_out << "Version\t" << Shard.Version << "\n";
+	Shard_out << "ReadGroup\t" << Shard.ReadGroup << "\n";
+	Shard_out << "CommandLine\t" << Shard.CommandLine << "\n";
+	Shard_out << "Format\t" << (Shard.Format == BamOutput ? "bam" : "sam") << "\n";
+	Shard_out << "HeaderBytes\t" << Shard.HeaderBytes << "\n";
+	Shard_out << "Threads\t" << Shard.Threads << "\n";
+	Shard_out << "WallSeconds\t" << Shard.WallSeconds << "\n";
+	if (Shard.InputEnded) {
+		Shard_out << "InputPairs\t" << Shard.InputPairs << "\n";
+	}
+	Shard_out << "TotalReads\t" << Shard.TotalReads << "\n";
+	Shard_out << "nMaskedPairs\t" << Totals.nMaskedReads << "\n";
+	Shard_out << "PrimerMatchedPairs\t" << Totals.PrimerMatchedReads << "\n";
+	Shard_out << "OffTargetPairs\t" << Totals.OffTargetReads << "\n";
+	Shard_out << "UsablePairs\t" << Totals.TotalUsableReads << "\n";
+	Shard_out << "UnmergedPairs\t" << Totals.TotalNotMergedReads << "\n";
+	Shard_out << "AlignedPairs\t" << Totals.TotalMappedReads << "\n";
+	Shard_out << "AlignmentCacheHits\t" << Totals.AlignmentCacheHits << "\n";
+	Shard_out << "AlignmentCacheMisses\t" << Totals.AlignmentCacheMisses << "\n";
+
+	//Stage name nanoseconds calls
+	for (n = 0; n < StageCount; ++n) {
+		Shard_out << "Stage\t" << StageNames[n] << "\t" << Totals.Timing.Nanoseconds[n] << "\t" << Totals.Timing.Calls[n] << "\n";
+	}
+
+	//Amplicon ID usable merged mapped alignments alignment nanoseconds; in amplicon file order
+	for (n = 0; n < Shard.AmpliconIDs.size(); ++n) {
+		const Stat& Amplicon = Totals.AmpliconStats[n];
+		Shard_out << "Amplicon\t" << Shard.AmpliconIDs[n] << "\t" << Amplicon.Usable << "\t" << Amplicon.Merged << "\t" << Amplicon.Mapped << "\t" <<
+			Amplicon.Alignments << "\t" << Amplicon.AlignmentNanoseconds << "\n";
+	}
+
+	//Batch first pair (0-based) pairs bytes
+	for (n = 0; n < Shard.Batches.size(); ++n) {
+		Shard_out << "Batch\t" << Shard.Batches[n].FirstPair << "\t" << Shard.Batches[n].Pairs << "\t" << Shard.Batches[n].Bytes << "\n";
+	}
+
+	return Shard_out.fail();
+}
+
+bool WriteShardStats(const string& Filename, const ShardStats& Shard) {
+
+	ofstream Shard_out(Filename);
+
+	WriteShardStats(Shard_out, Shard);
+	Shard_out.close();
+
+	return Shard_out.fail();
+}
+
+//Filename names the stats in error messages
+bool ReadShardStats(istream& Shard_in, const string& Filename, ShardStats& Shard) {
+
+	string Line, Key, Value;
+	vector<string> Fields;
+	set<string> Keys;
+	size_t Tab;
+	unsigned n;
+
+	getline(Shard_in, Line);
+
+	if (Line != ShardStatsHeader) {
+		std::cerr << "ERROR: " << Filename << " is not a shard stats file" << endl;
+		return 1;
+	}
+
+	Shard = ShardStats();
+	Shard.Totals = MappingStats();
+
+	try {
+		while (getline(Shard_in, Line)) {
+
+			if (Line == "" || Line[0] == '#') {
+				continue;
+			}
+
+			Tab = Line.find('\t');
+			Key = Line.substr(0, Tab);
+			Value = Tab == string::npos ? "" : Line.substr(Tab + 1);
+			Keys.insert(Key);
+
+			if (Key == "Version") {
+				Shard.Version = boost::lexical_cast<float>(Value);
+			} else if (Key == "ReadGroup") {
+				Shard.ReadGroup = Value;
+			} else if (Key == "CommandLine") {
+				Shard.CommandLine = Value;
+			} else if (Key == "Format") {
+				if (Value != "sam" && Value != "bam") {
+					throw boost::bad_lexical_cast();
+				}
+				Shard.Format = Value == "bam" ? BamOutput : SamOutput;
+			} else if (Key == "HeaderBytes") {
+				Shard.HeaderBytes = boost::lexical_cast<uint64_t>(Value);
+			} else if (Key == "Threads") {
+				Shard.Threads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "WallSeconds") {
+				Shard.WallSeconds = boost::lexical_cast<double>(Value);
+			} else if (Key == "InputPairs") {
+				Shard.InputEnded = true;
+				Shard.InputPairs = boost::lexical_cast<unsigned long>(Value);
+			} else if (Key == "TotalReads") {
+				Shard.TotalReads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "nMaskedPairs") {
+				Shard.Totals.nMaskedReads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "PrimerMatchedPairs") {
+				Shard.Totals.PrimerMatchedReads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "OffTargetPairs") {
+				Shard.Totals.OffTargetReads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "UsablePairs") {
+				Shard.Totals.TotalUsableReads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "UnmergedPairs") {
+				Shard.Totals.TotalNotMergedReads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "AlignedPairs") {
+				Shard.Totals.TotalMappedReads = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "AlignmentCacheHits") {
+				Shard.Totals.AlignmentCacheHits = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "AlignmentCacheMisses") {
+				Shard.Totals.AlignmentCacheMisses = boost::lexical_cast<unsigned>(Value);
+			} else if (Key == "Stage") {
+
+				boost::split(Fields, Value, boost::is_any_of("\t"));
+				if (Fields.size() != 3) {
+					throw boost::bad_lexical_cast();
+				}
+
+				for (n = 0; n < StageCount && Fields[0] != StageNames[n]; ++n);
+
+				if (n < StageCount) { //stages this version does not time are ignored
+					Shard.Totals.Timing.Nanoseconds[n] = boost::lexical_cast<uint64_t>(Fields[1]);
+					Shard.Totals.Timing.Calls[n] = boost::lexical_cast<unsigned long>(Fields[2]);
+				}
+
+			} else if (Key == "Amplicon") {
+
+				boost::split(Fields, Value, boost::is_any_of("\t"));
+				if (Fields.size() != 6) {
+					throw boost::bad_lexical_cast();
+				}
+
+				Stat Amplicon;
+				Amplicon.Usable = boost::lexical_cast<unsigned>(Fields[1]);
+				Amplicon.Merged = boost::lexical_cast<unsigned>(Fields[2]);
+				Amplicon.Mapped = boost::lexical_cast<unsigned>(Fields[3]);
+				Amplicon.Alignments = boost::lexical_cast<unsigned long>(Fields[4]);
+				Amplicon.AlignmentNanoseconds = boost::lexical_cast<uint64_t>(Fields[5]);
+
+				Shard.AmpliconIDs.push_back(Fields[0]);
+				Shard.Totals.AmpliconStats.push_back(Amplicon);
+
+			} else if (Key == "Batch") {
+
+				boost::split(Fields, Value, boost::is_any_of("\t"));
+				if (Fields.size() != 3) {
+					throw boost::bad_lexical_cast();
+				}
+
+				ShardBatch Batch;
+				Batch.FirstPair = boost::lexical_cast<unsigned long>(Fields[0]);
+				Batch.Pairs = boost::lexical_cast<unsigned long>(Fields[1]);
+				Batch.Bytes = boost::lexical_cast<uint64_t>(Fields[2]);
+
+				Shard.Batches.push_back(Batch);
+			}
+
+		}
+	} catch (boost::bad_lexical_cast&) {
+		std::cerr << "ERROR: " << Filename << " is improperly formatted: " << Line << endl;
+		return 1;
+	}
+
+	if (Keys.count("Version") == 0 || Keys.count("Format") == 0 || Keys.count("HeaderBytes") == 0 || Keys.count("TotalReads") == 0) {
+		std::cerr << "ERROR: " << Filename << " is incomplete" << endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+bool ReadShardStats(const string& Filename, ShardStats& Shard) {
+
+	ifstream Shard_in(Filename);
+
+	if (!Shard_in.is_open()) {
+		std::cerr << "ERROR: Unable to open shard stats " << Filename << endl;
+		return 1;
+	}
+
+	return ReadShardStats(Shard_in, Filename, Shard);
+}
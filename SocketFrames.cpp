@@ -0,0 +1,131 @@
+/*
+* Filename : SocketFrames.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Connects to the alignment server's socket and writes and reads the tagged, length prefixed frames it exchanges.
+* Status: Release
+*/
+
+#include <string>
+#include <cstdint>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+A frame is a four character tag, the payload length as a 32-bit little endian integer and the payload. Partial sends and
+receives are continued until the whole frame has been transferred.
+*/
+
+static bool SendAll(int Socket, const char* Data, size_t Len) {
+
+	ssize_t Sent;
+
+	while (Len > 0) {
+
+		Sent = send(Socket, Data, Len, MSG_NOSIGNAL); //a closed peer is an error, not a signal
+
+		if (Sent < 0 && errno == EINTR) {
+			continue;
+		} else if (Sent <= 0) {
+			return 1;
+		}
+
+		Data += Sent;
+		Len -= Sent;
+	}
+
+	return 0;
+}
+
+static bool ReceiveAll(int Socket, char* Data, size_t Len) {
+
+	ssize_t Received;
+
+	while (Len > 0) {
+
+		Received = recv(Socket, Data, Len, 0);
+
+		if (Received < 0 && errno == EINTR) {
+			continue;
+		} else if (Received <= 0) {
+			return 1;
+		}
+
+		Data += Received;
+		Len -= Received;
+	}
+
+	return 0;
+}
+
+//returns the connected socket or -1
+int ConnectSocket(const string& SocketPath) {
+
+	struct sockaddr_un Address = sockaddr_un();
+	int Socket;
+
+	if (SocketPath.length() >= sizeof(Address.sun_path)) {
+		return -1;
+	}
+
+	Address.sun_family = AF_UNIX;
+	SocketPath.copy(Address.sun_path, SocketPath.length());
+
+	if ((Socket = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+
+	if (connect(Socket, (struct sockaddr*) &Address, sizeof(Address)) != 0) {
+		close(Socket);
+		return -1;
+	}
+
+	return Socket;
+}
+
+bool WriteFrame(int Socket, const string& Tag, const string& Payload) {
+
+	char Header[8];
+
+	if (Tag.length() != 4 || Payload.size() > SocketFrameMaxBytes) {
+		return 1;
+	}
+
+	Tag.copy(Header, 4);
+
+	for (unsigned b = 0; b < 4; ++b) {
+		Header[4 + b] = (char) ((uint32_t) Payload.size() >> (8 * b));
+	}
+
+	return SendAll(Socket, Header, 8) == 1 || SendAll(Socket, Payload.data(), Payload.size()) == 1;
+}
+
+//returns 1 at the end of the stream as well as on error
+bool ReadFrame(int Socket, string& Tag, string& Payload) {
+
+	unsigned char Header[8];
+	uint32_t Len = 0;
+
+	if (ReceiveAll(Socket, (char*) Header, 8) == 1) {
+		return 1;
+	}
+
+	for (unsigned b = 0; b < 4; ++b) {
+		Len |= (uint32_t) Header[4 + b] << (8 * b);
+	}
+
+	if (Len > SocketFrameMaxBytes) {
+		return 1;
+	}
+
+	Tag.assign((char*) Header, 4);
+	Payload.resize(Len);
+
+	return Len > 0 && ReceiveAll(Socket, &Payload[0], Len) == 1;
+}
@@ -0,0 +1,360 @@
+/*
+* Filename : SortedBamStreamBuf.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Output stream buffer taking BAM records in any order and writing a coordinate-sorted BAM with its .bai index.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include "SortedBamStreamBuf.h"
+
+using namespace std;
+
+/*									Method
+Every record of an amplicon starts at the amplicon's Pos, so records are grouped by start coordinate as they arrive and
+the groups are written in (@SQ order, Pos) order at close; no record is compared with another. Records keep their input
+order within a group. Groups are held in memory until MaxMemory bytes, then every group is appended to one temp file and
+the group remembers where; at close each group's spilled runs are read back in order followed by what is still in memory.
+The .bai index is built while the sorted records are written (SAM specification 5.2).
+*/
+
+static const unsigned BamMinRecordLen = 32, BaiPseudoBin = 37450, BaiWindowShift = 14;
+
+static uint32_t GetLE(const char* Data, unsigned Bytes) {
+
+	uint32_t Value = 0;
+
+	for (unsigned b = 0; b < Bytes; ++b) {
+		Value |= (uint32_t) (unsigned char) Data[b] << (8 * b);
+	}
+
+	return Value;
+}
+
+static void AppendLE(string& Out, uint64_t Value, unsigned Bytes) {
+	for (unsigned b = 0; b < Bytes; ++b) {
+		Out += (char) ((Value >> (8 * b)) & 0xff);
+	}
+}
+
+SortedBamStreamBuf::SortedBamStreamBuf(const string& Filename, unsigned Threads, unsigned References, size_t MaxMemory) :
+	Filename(Filename), Bam(Filename, Threads), Spill(NULL), MaxMemory(MaxMemory), Buffered(0), SpillOffset(0), NoCoordinate(0),
+	Index(References), Failed(false), Closed(false) {
+
+	for (unsigned r = 0; r < References; ++r) {
+		Index[r].Begin = Index[r].End = Index[r].Mapped = Index[r].Unmapped = 0;
+	}
+
+}
+
+SortedBamStreamBuf::~SortedBamStreamBuf() {
+	close();
+}
+
+void SortedBamStreamBuf::SetHeader(const string& BamHeader) {
+	Header = BamHeader;
+}
+
+streamsize SortedBamStreamBuf::xsputn(const char* Data, streamsize Len) {
+
+	size_t Used;
+
+	//the pipeline writes whole records; anything left over waits for the next write
+	if (Partial.empty()) {
+		Used = AddRecords(Data, Len);
+		Partial.assign(Data + Used, Len - Used);
+	} else {
+		Partial.append(Data, Len);
+		Used = AddRecords(Partial.data(), Partial.size());
+		Partial.erase(0, Used);
+	}
+
+	if (Buffered > MaxMemory) {
+		SpillGroups();
+	}
+
+	return Failed ? 0 : Len;
+}
+
+int SortedBamStreamBuf::overflow(int c) {
+
+	if (c != traits_type::eof()) {
+		char Byte = (char) c;
+		xsputn(&Byte, 1);
+	}
+
+	return Failed ? traits_type::eof() : traits_type::not_eof(c);
+}
+
+//adds complete records to their groups; returns the bytes used
+size_t SortedBamStreamBuf::AddRecords(const char* Data, size_t Len) {
+
+	size_t n = 0, RecordLen;
+	uint64_t Key;
+
+	while (n + 4 <= Len) {
+
+		RecordLen = 4 + (size_t) GetLE(Data + n, 4);
+
+		if (RecordLen < 4 + BamMinRecordLen) {
+			Failed = true; //not a BAM record
+			return Len;
+		} else if (n + RecordLen > Len) {
+			break;
+		}
+
+		Key = (uint64_t) GetLE(Data + n + 4, 4) << 32 | GetLE(Data + n + 8, 4); //RefID, Pos
+
+		auto Group = GroupIndex.find(Key);
+
+		if (Group == GroupIndex.end()) {
+			Group = GroupIndex.insert(make_pair(Key, (unsigned) Groups.size())).first;
+			Groups.push_back(TGroup());
+			Groups.back().RefID = (int32_t) GetLE(Data + n + 4, 4);
+			Groups.back().Pos = (int32_t) GetLE(Data + n + 8, 4);
+		}
+
+		Groups[Group->second].Records.append(Data + n, RecordLen);
+		Buffered += RecordLen;
+		n += RecordLen;
+	}
+
+	return n;
+}
+
+void SortedBamStreamBuf::SpillGroups() {
+
+	if (Spill == NULL && (Spill = fopen((Filename + ".tmp").c_str(), "w+b")) == NULL) {
+		Failed = true;
+		return;
+	}
+
+	for (unsigned g = 0; g < Groups.size(); ++g) {
+
+		string& Records = Groups[g].Records;
+
+		if (Records.empty()) {
+			continue;
+		}
+
+		if (fwrite(Records.data(), 1, Records.size(), Spill) != Records.size()) {
+			Failed = true;
+		}
+
+		Groups[g].Spilled.push_back(make_pair(SpillOffset, (uint64_t) Records.size()));
+		SpillOffset += Records.size();
+
+		string().swap(Records); //release the memory
+	}
+
+	Buffered = 0;
+}
+
+//writes records to the BAM and adds them to the index
+void SortedBamStreamBuf::WriteRecords(const string& Records) {
+
+	size_t n = 0, RecordLen;
+	uint64_t Start, End;
+	unsigned Op, w, RefLen, Flag;
+	int32_t RefID, Beg;
+
+	while (n + 4 <= Records.size()) {
+
+		const char* Record = &Records[n];
+		RecordLen = 4 + (size_t) GetLE(Record, 4);
+
+		Start = Bam.Tell();
+		if ((size_t) Bam.sputn(Record, RecordLen) != RecordLen) {
+			Failed = true;
+		}
+		End = Bam.Tell();
+
+		n += RecordLen;
+
+		RefID = (int32_t) GetLE(Record + 4, 4);
+		Beg = (int32_t) GetLE(Record + 8, 4);
+
+		if (RefID < 0 || (size_t) RefID >= Index.size() || Beg < 0) {
+			NoCoordinate++;
+			continue;
+		}
+
+		TReferenceIndex& Reference = Index[RefID];
+
+		//reference bases covered by the cigar
+		const char* Cigar = Record + 36 + (unsigned char) Record[12];
+		RefLen = 0;
+
+		for (Op = 0; Op < GetLE(Record + 16, 2); ++Op) {
+			switch (GetLE(Cigar + 4 * Op, 4) & 0xf) {
+				case 0: case 2: case 3: case 7: case 8: RefLen += GetLE(Cigar + 4 * Op, 4) >> 4; break; //M D N = X
+			}
+		}
+
+		Flag = GetLE(Record + 18, 2);
+		if (Flag & 4) {
+			Reference.Unmapped++;
+		} else {
+			Reference.Mapped++;
+		}
+
+		if (Reference.Mapped + Reference.Unmapped == 1) {
+			Reference.Begin = Start;
+		}
+		Reference.End = End;
+
+		//records of a group share a bin so their chunks join up
+		vector<pair<uint64_t, uint64_t>>& Chunks = Reference.Bins[GetLE(Record + 14, 2)];
+
+		if (!Chunks.empty() && Chunks.back().second == Start) {
+			Chunks.back().second = End;
+		} else {
+			Chunks.push_back(make_pair(Start, End));
+		}
+
+		//first record overlapping each 16kb window
+		for (w = Beg >> BaiWindowShift; w <= (Beg + max(RefLen, 1U) - 1) >> BaiWindowShift; ++w) {
+
+			if (w >= Reference.Intervals.size()) {
+				Reference.Intervals.resize(w + 1, UINT64_MAX);
+			}
+
+			if (Reference.Intervals[w] == UINT64_MAX) {
+				Reference.Intervals[w] = Start;
+			}
+		}
+
+	}
+
+}
+
+bool SortedBamStreamBuf::WriteIndex(const string& IndexFilename) { //returns 1 on error
+
+	string Out = "BAI\1";
+	uint64_t Interval;
+	FILE* Index_out;
+
+	AppendLE(Out, Index.size(), 4);
+
+	for (unsigned r = 0; r < Index.size(); ++r) {
+
+		const TReferenceIndex& Reference = Index[r];
+		bool HasRecords = Reference.Mapped + Reference.Unmapped > 0;
+
+		AppendLE(Out, Reference.Bins.size() + HasRecords, 4);
+
+		for (auto Bin = Reference.Bins.begin(); Bin != Reference.Bins.end(); ++Bin) {
+			AppendLE(Out, Bin->first, 4);
+			AppendLE(Out, Bin->second.size(), 4);
+			for (unsigned c = 0; c < Bin->second.size(); ++c) {
+				AppendLE(Out, Bam.VirtualOffset(Bin->second[c].first), 8);
+				AppendLE(Out, Bam.VirtualOffset(Bin->second[c].second), 8);
+			}
+		}
+
+		//samtools metadata: span of the reference's records and its mapped and unmapped counts
+		if (HasRecords) {
+			AppendLE(Out, BaiPseudoBin, 4);
+			AppendLE(Out, 2, 4);
+			AppendLE(Out, Bam.VirtualOffset(Reference.Begin), 8);
+			AppendLE(Out, Bam.VirtualOffset(Reference.End), 8);
+			AppendLE(Out, Reference.Mapped, 8);
+			AppendLE(Out, Reference.Unmapped, 8);
+		}
+
+		//windows without a record take the previous window's offset
+		AppendLE(Out, Reference.Intervals.size(), 4);
+		Interval = 0;
+		for (unsigned w = 0; w < Reference.Intervals.size(); ++w) {
+			if (Reference.Intervals[w] != UINT64_MAX) {
+				Interval = Bam.VirtualOffset(Reference.Intervals[w]);
+			}
+			AppendLE(Out, Interval, 8);
+		}
+
+	}
+
+	AppendLE(Out, NoCoordinate, 8);
+
+	if ((Index_out = fopen(IndexFilename.c_str(), "wb")) == NULL) {
+		return 1;
+	}
+
+	bool WriteFailed = fwrite(Out.data(), 1, Out.size(), Index_out) != Out.size();
+
+	return fclose(Index_out) != 0 || WriteFailed;
+}
+
+bool SortedBamStreamBuf::close() {
+
+	vector<unsigned> Order(Groups.size());
+	string Chunk;
+	unsigned g, s;
+
+	if (Closed) {
+		return !Failed;
+	}
+
+	Closed = true;
+
+	if (!Partial.empty()) {
+		Failed = true; //truncated record
+	}
+
+	//@SQ order then position; unmapped (RefID -1) last
+	for (g = 0; g < Groups.size(); ++g) {
+		Order[g] = g;
+	}
+	sort(Order.begin(), Order.end(), [this](unsigned a, unsigned b) {
+		return make_pair((uint32_t) Groups[a].RefID, (uint32_t) Groups[a].Pos) < make_pair((uint32_t) Groups[b].RefID, (uint32_t) Groups[b].Pos);
+	});
+
+	if (Bam.is_open()) {
+
+		Bam.sputn(Header.data(), Header.size());
+		Bam.FlushBlock(); //header in its own blocks
+
+		for (g = 0; g < Order.size(); ++g) {
+
+			TGroup& Group = Groups[Order[g]];
+
+			for (s = 0; s < Group.Spilled.size(); ++s) {
+
+				Chunk.resize(Group.Spilled[s].second);
+
+				if (fseeko(Spill, Group.Spilled[s].first, SEEK_SET) != 0 || fread(&Chunk[0], 1, Chunk.size(), Spill) != Chunk.size()) {
+					Failed = true;
+					break;
+				}
+
+				WriteRecords(Chunk);
+			}
+
+			WriteRecords(Group.Records);
+			string().swap(Group.Records);
+		}
+
+	}
+
+	if (Bam.close() == false) {
+		Failed = true;
+	}
+
+	if (Spill != NULL) {
+		fclose(Spill);
+		remove((Filename + ".tmp").c_str());
+		Spill = NULL;
+	}
+
+	if (Failed == false && WriteIndex(Filename + ".bai") == 1) {
+		Failed = true;
+	}
+
+	return !Failed;
+}
@@ -0,0 +1,67 @@
+/*
+* Filename : SortedBamStreamBuf.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Output stream buffer taking BAM records in any order and writing a coordinate-sorted BAM with its .bai index.
+* Status: Release
+*/
+
+#ifndef SORTEDBAMSTREAMBUF_H
+#define SORTEDBAMSTREAMBUF_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdint>
+#include <streambuf>
+#include <unordered_map>
+#include "BgzfStreamBuf.h"
+
+using namespace std;
+
+class SortedBamStreamBuf : public streambuf {
+public:
+	//records are held in memory up to MaxMemory bytes then spilled to Filename.tmp
+	SortedBamStreamBuf(const string& Filename, unsigned Threads, unsigned References, size_t MaxMemory);
+	~SortedBamStreamBuf();
+
+	bool is_open() const { return Bam.is_open(); }
+	void SetHeader(const string& BamHeader); //written ahead of the sorted records
+	bool close(); //writes the sorted records, the EOF marker and Filename.bai; false on error
+
+protected:
+	streamsize xsputn(const char* Data, streamsize Len);
+	int overflow(int c);
+
+private:
+	typedef struct {
+		int32_t RefID;
+		int32_t Pos;
+		string Records; //in input order
+		vector<pair<uint64_t, uint64_t>> Spilled; //offset and length of earlier records in the temp file
+	} TGroup; //records sharing one start coordinate; every record of an amplicon starts at its Pos
+
+	typedef struct {
+		map<unsigned, vector<pair<uint64_t, uint64_t>>> Bins; //chunks of each bin
+		vector<uint64_t> Intervals; //lowest offset overlapping each 16kb window
+		uint64_t Begin, End, Mapped, Unmapped;
+	} TReferenceIndex; //offsets are Tell positions until the BAM is closed
+
+	size_t AddRecords(const char* Data, size_t Len);
+	void SpillGroups();
+	void WriteRecords(const string& Records);
+	bool WriteIndex(const string& Filename);
+
+	string Filename, Header, Partial; //Partial holds an incomplete record between writes
+	BgzfStreamBuf Bam;
+	FILE* Spill;
+	size_t MaxMemory, Buffered;
+	uint64_t SpillOffset, NoCoordinate;
+	vector<TGroup> Groups;
+	unordered_map<uint64_t, unsigned> GroupIndex; //RefID and Pos to group
+	vector<TReferenceIndex> Index;
+	bool Failed, Closed;
+};
+
+#endif
@@ -0,0 +1,50 @@
+/*
+* Filename : StageTiming.h
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Cumulative time and calls of each read processing stage; compile with -DNO_STAGE_TIMING to remove.
+* Status: Release
+*/
+
+#ifndef STAGETIMING_H
+#define STAGETIMING_H
+
+#include <cstdint>
+#include <chrono>
+
+enum PipelineStage { StageDecompress, StageParse, StageNMask, StagePrimerMatch, StageOffTarget, StageClip, StageMerge, StageAlign, StageCigar, StageFormat, StageOutputStall, StageCount };
+
+const char* const StageNames[StageCount] = { "decompress", "parse", "n_mask", "primer_match", "off_target", "clip", "merge", "align", "cigar", "format", "output_stall" }; //as written to timing files
+
+typedef struct {
+	uint64_t Nanoseconds[StageCount];
+	unsigned long Calls[StageCount];
+} StageTiming;
+
+#ifndef NO_STAGE_TIMING
+
+inline uint64_t StageClock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//adds the time since Start to Stage; returns the end time, which starts the next stage
+inline uint64_t EndStage(StageTiming& Timing, const PipelineStage Stage, const uint64_t Start) {
+	uint64_t Now = StageClock();
+	Timing.Nanoseconds[Stage] += Now - Start;
+	Timing.Calls[Stage]++;
+	return Now;
+}
+
+#else
+
+inline uint64_t StageClock() {
+	return 0;
+}
+
+inline uint64_t EndStage(StageTiming&, const PipelineStage, const uint64_t) {
+	return 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,81 @@
+/*
+* Filename : UngappedAlignment.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Aligns merged reads without indels directly when no gapped alignment can score as well.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+/*									Method
+A read as long as the reference aligned base for base scores (Length - Mismatches) * 1 + Mismatches * -3. Any gapped
+global alignment of equal lengths needs a gap in each sequence; end gaps are penalised, so it scores at most
+(Length - 1) * 1 + 2 * -8. When the ungapped score is higher it is the unique optimum that BandedGlobalAlignment would
+trace back, and the CIGAR and NM are those getCigarNM gives for a single match run.
+*/
+
+static const int MatchScore = 1, MismatchScore = -3, GapOpenScore = -8;
+
+//also used by getCigarNM for the primer bases
+unsigned CountMismatches(const char* Ref, const char* Query, size_t Len) {
+
+	unsigned Mismatches = 0;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= Len; i += 16) {
+		__m128i Equal = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (Ref + i)), _mm_loadu_si128((const __m128i*) (Query + i)));
+		Mismatches += __builtin_popcount(~_mm_movemask_epi8(Equal) & 0xffff);
+	}
+#endif
+
+	for (; i < Len; ++i) {
+		if (Ref[i] != Query[i]) {
+			Mismatches++;
+		}
+	}
+
+	return Mismatches;
+}
+
+//returns 1 if the read needs the full alignment
+bool UngappedAlignment(const string& Ref, const string& Query, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted,
+	int& NWScore, PackedCigar& Cigar, unsigned& SingleBaseMisMatchFrequency) {
+
+	const unsigned Length = Query.length();
+	unsigned PrimerMismatches, InsertMismatches;
+
+	if (Ref.length() != Length || Length <= LeftPrimerLengthStrandConverted + RightPrimerLengthStrandConverted) {
+		return 1;
+	}
+
+	//primer mismatches count towards the score but not the edit distance
+	InsertMismatches = CountMismatches(Ref.data() + LeftPrimerLengthStrandConverted, Query.data() + LeftPrimerLengthStrandConverted,
+		Length - LeftPrimerLengthStrandConverted - RightPrimerLengthStrandConverted);
+	PrimerMismatches = CountMismatches(Ref.data(), Query.data(), LeftPrimerLengthStrandConverted) +
+		CountMismatches(Ref.data() + Length - RightPrimerLengthStrandConverted, Query.data() + Length - RightPrimerLengthStrandConverted, RightPrimerLengthStrandConverted);
+
+	NWScore = (int) (Length - InsertMismatches - PrimerMismatches) * MatchScore + (int) (InsertMismatches + PrimerMismatches) * MismatchScore;
+
+	//possibly beaten by a gapped alignment; or below the minimum score
+	if (NWScore <= (int) (Length - 1) * MatchScore + 2 * GapOpenScore || NWScore < 0) {
+		return 1;
+	}
+
+	Cigar.Ops.resize(3);
+	Cigar.Ops[0] = LeftPrimerLengthStrandConverted << 4 | CigarSoftClip;
+	Cigar.Ops[1] = (Length - LeftPrimerLengthStrandConverted - RightPrimerLengthStrandConverted) << 4 | CigarMatch;
+	Cigar.Ops[2] = RightPrimerLengthStrandConverted << 4 | CigarSoftClip;
+	Cigar.NM = InsertMismatches;
+	SingleBaseMisMatchFrequency = InsertMismatches;
+
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+* Filename : WriteMappingStats.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Writes a sample's read pair counts and per amplicon usable, merged and mapped reads.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <unordered_map>
+#include "AmpliconAlignerV2.h"
+#include "AsyncFileStreamBuf.h"
+
+using namespace std;
+
+//ReadGroup is empty if no reads were found
+bool WriteMappingStats(const string& Filename, const string& ReadGroup, const string& CommandLine, const float Version, const unsigned TotalReads,
+	const MappingStats& Totals, const vector<string>& AmpliconIDs) {
+
+	AsyncFileStreamBuf STATS_buf(Filename, 1 << 16);
+	ostream STATS_out(&STATS_buf);
+	unordered_map <string, Stat> Stats;
+	unsigned n;
+
+	if (!ReadGroup.empty()) {
+		STATS_out << "#ID:" << ReadGroup << "\n";
+		STATS_out << "#CL:" << CommandLine;
+		STATS_out << "\n#PG:IndelAmpliconAligner v" << Version << "\n";
+	}
+
+	//per amplicon counts are reported by ID
+	for (n = 0; n < AmpliconIDs.size(); ++n) {
+		Stats[AmpliconIDs[n]].Usable += Totals.AmpliconStats[n].Usable;
+		Stats[AmpliconIDs[n]].Merged += Totals.AmpliconStats[n].Merged;
+		Stats[AmpliconIDs[n]].Mapped += Totals.AmpliconStats[n].Mapped;
+	}
+
+	//mapping stats
+	STATS_out << "#TotalReads:" << TotalReads << "\n";
+	STATS_out << "#PrimerMatchedPairs:" << Totals.PrimerMatchedReads << "\n";
+	STATS_out << "#OffTargetPairs:" << Totals.OffTargetReads << ' ' << (float)Totals.OffTargetReads / Totals.PrimerMatchedReads * 100 << "%\n";
+	STATS_out << "#UsablePairs:" << Totals.TotalUsableReads << "\n";
+	STATS_out << "#UnmergedPairs:" << Totals.TotalNotMergedReads << ' ' << (float)Totals.TotalNotMergedReads / Totals.TotalUsableReads * 100 << "%\n";
+	STATS_out << "#TotalAlignedPairs:" << Totals.TotalMappedReads << ' ' << (float)Totals.TotalMappedReads / Totals.TotalUsableReads * 100 << "%\n";
+
+	STATS_out << "#Amplicon\tUsableReads\tMergedReads\tMappedReads\n";
+	for (n = 0; n < AmpliconIDs.size(); ++n) {
+		STATS_out << AmpliconIDs[n] << "\t" << Stats[AmpliconIDs[n]].Usable << "\t" << Stats[AmpliconIDs[n]].Merged << "\t" << Stats[AmpliconIDs[n]].Mapped << "\n";
+	}
+
+	return STATS_buf.close() == false || STATS_out.fail();
+}
@@ -0,0 +1,91 @@
+/*
+* Filename : WriteStageTiming.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Writes cumulative time and calls of each read processing stage, alignment cache use and per amplicon alignment time as JSON.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+static void AppendJsonString(string& Out, const string& Value) {
+
+	char Escape[8];
+
+	Out += '"';
+
+	for (unsigned n = 0; n < Value.length(); ++n) {
+		if (Value[n] == '"' || Value[n] == '\\') {
+			Out += '\\';
+			Out += Value[n];
+		} else if ((unsigned char) Value[n] < 0x20) {
+			snprintf(Escape, sizeof(Escape), "\\u%04x", (unsigned char) Value[n]);
+			Out += Escape;
+		} else {
+			Out += Value[n];
+		}
+	}
+
+	Out += '"';
+}
+
+static void AppendSeconds(string& Out, uint64_t Nanoseconds) {
+	char Number[32];
+	snprintf(Number, sizeof(Number), "%.6f", Nanoseconds / 1e9);
+	Out += Number;
+}
+
+//stage times are summed over threads; decompression and parsing run beside the workers
+bool WriteStageTiming(const string& Filename, const MappingStats& Totals, const vector<string>& AmpliconIDs, const unsigned Threads, const double WallSeconds) {
+
+	ofstream Timing_out(Filename);
+	string Json;
+	unsigned s, n;
+
+	Json += "{\n\t\"threads\": ";
+	AppendNumber(Json, Threads);
+	Json += ",\n\t\"wall_seconds\": ";
+	AppendSeconds(Json, (uint64_t) (WallSeconds * 1e9));
+
+	//depend on which thread aligned a repeated sequence first, so they are kept out of the mapping stats
+	Json += ",\n\t\"alignment_cache\": {\"hits\": ";
+	AppendNumber(Json, Totals.AlignmentCacheHits);
+	Json += ", \"misses\": ";
+	AppendNumber(Json, Totals.AlignmentCacheMisses);
+	Json += "},\n\t\"stages\": {";
+
+	for (s = 0; s < StageCount; ++s) {
+		Json += s == 0 ? "\n\t\t\"" : ",\n\t\t\"";
+		Json += StageNames[s];
+		Json += "\": {\"seconds\": ";
+		AppendSeconds(Json, Totals.Timing.Nanoseconds[s]);
+		Json += ", \"calls\": ";
+		AppendNumber(Json, Totals.Timing.Calls[s]);
+		Json += '}';
+	}
+
+	Json += "\n\t},\n\t\"amplicons\": [";
+
+	for (n = 0; n < AmpliconIDs.size(); ++n) {
+		Json += n == 0 ? "\n\t\t{\"id\": " : ",\n\t\t{\"id\": ";
+		AppendJsonString(Json, AmpliconIDs[n]);
+		Json += ", \"alignments\": ";
+		AppendNumber(Json, Totals.AmpliconStats[n].Alignments);
+		Json += ", \"alignment_seconds\": ";
+		AppendSeconds(Json, Totals.AmpliconStats[n].AlignmentNanoseconds);
+		Json += '}';
+	}
+
+	Json += "\n\t]\n}\n";
+
+	Timing_out << Json;
+	Timing_out.close();
+
+	return Timing_out.fail();
+}
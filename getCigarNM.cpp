@@ -1,136 +1,82 @@
-/*
-* Filename : getCigarNM.cpp
-* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
-* Contact : mlyon@live.co.uk
-* Description : Calculates read alignment cigar and edit distance.
-* Status: Release
-*/
-
-#include <string>
-#include <vector>
-#include <seqan/Align.h>
-#include <boost/lexical_cast.hpp>
-#include "AmpliconAlignerV2.h"
-
-using namespace std;
-
-bool getCigarNM(TRow& row1, TRow& row2, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted, pair<string, unsigned>& CigarNM, unsigned& SingleBaseMisMatchFrequency) {
-	
-	TRowIterator Rit = seqan::begin(row1), RitEnd = seqan::end(row1), Qit = seqan::begin(row2), QitEnd = seqan::end(row2);
-	unsigned j = 0;
-	vector<pair<char, unsigned>> CigarPairs;
-	pair<char, unsigned> Cigartemp;
-	CigarNM.first = "";
-	CigarNM.second = 0;
-	SingleBaseMisMatchFrequency = 0;
-
-	//iterate over Query Alignment
-	for (; Qit != QitEnd; ++Qit, ++Rit) {
-		j++; //1-based
-
-		if (isGap(Qit)) { //Query deleteion
-
-			if (Qit == seqan::begin(row2)) {
-				Cigartemp.first = 'D';
-				Cigartemp.second = 1;
-			} else if (Cigartemp.first != 'D') {
-				CigarPairs.push_back(Cigartemp);
-				Cigartemp.first = 'D';
-				Cigartemp.second = 1;
-			} else { //contig base
-				Cigartemp.second++;
-			}
-
-		} else if (isGap(Rit)) { //Query insertion
-
-			if (Qit == seqan::begin(row2)) {
-				Cigartemp.first = 'I';
-				Cigartemp.second = 1;
-			} else if (Cigartemp.first != 'I') {
-				CigarPairs.push_back(Cigartemp);
-				Cigartemp.first = 'I';
-				Cigartemp.second = 1;
-			} else { //contig base
-				Cigartemp.second++;
-			}
-
-		} else { //Query match/mismatch
-
-			if (Qit == seqan::begin(row2)) {
-				Cigartemp.first = 'M';
-				Cigartemp.second = 1;
-			} else if (Cigartemp.first != 'M') {
-				CigarPairs.push_back(Cigartemp);
-				Cigartemp.first = 'M';
-				Cigartemp.second = 1;
-			} else { //contig base
-				Cigartemp.second++;
-			}
-
-			if (value(Qit) != value(Rit) && j > LeftPrimerLengthStrandConverted && j <= (QitEnd - seqan::begin(row2)) - RightPrimerLengthStrandConverted) { //base mismatch not in primer
-				CigarNM.second++; //edit distance
-				SingleBaseMisMatchFrequency++;
-			}
-
-		}
-
-	} //end iterating over Alignemnt
-
-	//load last Cigar
-	CigarPairs.push_back(Cigartemp);
-
-	//softclip primers
-	if (CigarPairs.size() == 1) { //all bases match/mismatch
-
-		if (CigarPairs[0].first == 'M' && CigarPairs[0].second > (LeftPrimerLengthStrandConverted + RightPrimerLengthStrandConverted)) { //matching bases exceed primer length
-			CigarNM.first = boost::lexical_cast<string>(LeftPrimerLengthStrandConverted);
-			CigarNM.first += 'S';
-			CigarNM.first += boost::lexical_cast<string>(CigarPairs[0].second - (LeftPrimerLengthStrandConverted + RightPrimerLengthStrandConverted));
-			CigarNM.first += 'M';
-			CigarNM.first += boost::lexical_cast<string>(RightPrimerLengthStrandConverted);
-			CigarNM.first += 'S';
-		} else {
-			return 1; //just primer; skipped
-		}
-
-	} else if (CigarPairs.size() > 2) {
-
-		if (CigarPairs[0].first == 'M' && CigarPairs[0].second >= LeftPrimerLengthStrandConverted && CigarPairs[CigarPairs.size() - 1].first == 'M' && CigarPairs[CigarPairs.size() - 1].second >= RightPrimerLengthStrandConverted) { //matching bases exceed primer length
-			
-			CigarNM.first = boost::lexical_cast<string>(LeftPrimerLengthStrandConverted);
-			CigarNM.first += 'S';
-
-			if (CigarPairs[0].second > LeftPrimerLengthStrandConverted) {
-				CigarNM.first += boost::lexical_cast<string>(CigarPairs[0].second - LeftPrimerLengthStrandConverted);
-				CigarNM.first += 'M';
-			}
-
-			for (j = 1; j < CigarPairs.size() - 1; j++) { //iterate over Cigars ignore first and last
-				CigarNM.first += boost::lexical_cast<string>(CigarPairs[j].second);
-				CigarNM.first += CigarPairs[j].first;
-
-				//region is del or ins add to edit distance
-				if (CigarPairs[j].first != 'M') {
-					CigarNM.second += CigarPairs[j].second;
-				}
-
-			}
-
-			if (CigarPairs[CigarPairs.size() - 1].second > RightPrimerLengthStrandConverted) {
-				CigarNM.first += boost::lexical_cast<string>(CigarPairs[CigarPairs.size() - 1].second - RightPrimerLengthStrandConverted);
-				CigarNM.first += 'M';
-			}
-
-			CigarNM.first += boost::lexical_cast<string>(RightPrimerLengthStrandConverted);
-			CigarNM.first += 'S';
-
-		} else {
-			return 1;
-		}
-
-	} else {
-		return 1; //0 or 2 skipped
-	}
-
-	return 0;
-}
\ No newline at end of file
+/*
+* Filename : getCigarNM.cpp
+* Author : Matthew Lyon, Wessex Regional Genetics Laboratory, Salisbury, UK & University of Southampton, UK
+* Contact : mlyon@live.co.uk
+* Description : Soft clips primers from the packed alignment cigar and calculates edit distance; writes cigar text.
+* Status: Release
+*/
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "AmpliconAlignerV2.h"
+
+using namespace std;
+
+//Cigar holds the traceback operations and all mismatches in NM; primers are soft clipped in place and NM becomes the edit distance
+bool getCigarNM(const string& Ref, const string& Query, const unsigned LeftPrimerLengthStrandConverted, const unsigned RightPrimerLengthStrandConverted,
+	PackedCigar& Cigar, unsigned& SingleBaseMisMatchFrequency) {
+
+	vector<uint32_t>& Ops = Cigar.Ops;
+	const unsigned Last = Ops.size() - 1;
+	unsigned j, FirstLen, LastLen;
+
+	if (Ops.size() == 0 || Ops.size() == 2) {
+		return 1; //0 or 2 skipped
+	}
+
+	FirstLen = Ops[0] >> 4;
+	LastLen = Ops[Last] >> 4;
+
+	//primers must lie within the outer match runs
+	if ((Ops[0] & 0xf) != CigarMatch || (Ops[Last] & 0xf) != CigarMatch) {
+		return 1;
+	} else if (Ops.size() == 1 && FirstLen <= LeftPrimerLengthStrandConverted + RightPrimerLengthStrandConverted) {
+		return 1; //just primer; skipped
+	} else if (FirstLen < LeftPrimerLengthStrandConverted || LastLen < RightPrimerLengthStrandConverted) {
+		return 1;
+	}
+
+	//base mismatches not in primer; the outer runs align the first and last bases of both sequences
+	SingleBaseMisMatchFrequency = Cigar.NM - CountMismatches(Ref.data(), Query.data(), LeftPrimerLengthStrandConverted) -
+		CountMismatches(Ref.data() + Ref.length() - RightPrimerLengthStrandConverted, Query.data() + Query.length() - RightPrimerLengthStrandConverted, RightPrimerLengthStrandConverted);
+	Cigar.NM = SingleBaseMisMatchFrequency; //edit distance
+
+	//region is del or ins add to edit distance
+	for (j = 1; j < Last; ++j) {
+		if ((Ops[j] & 0xf) != CigarMatch) {
+			Cigar.NM += Ops[j] >> 4;
+		}
+	}
+
+	//softclip primers
+	if (Ops.size() == 1) { //all bases match/mismatch
+		Ops.resize(3);
+		Ops[1] = (FirstLen - LeftPrimerLengthStrandConverted - RightPrimerLengthStrandConverted) << 4 | CigarMatch;
+	} else {
+
+		if (LastLen > RightPrimerLengthStrandConverted) {
+			Ops[Last] = (LastLen - RightPrimerLengthStrandConverted) << 4 | CigarMatch;
+			Ops.push_back(0);
+		}
+
+		if (FirstLen > LeftPrimerLengthStrandConverted) {
+			Ops[0] = (FirstLen - LeftPrimerLengthStrandConverted) << 4 | CigarMatch;
+			Ops.insert(Ops.begin(), 0);
+		}
+
+	}
+
+	Ops.front() = LeftPrimerLengthStrandConverted << 4 | CigarSoftClip;
+	Ops.back() = RightPrimerLengthStrandConverted << 4 | CigarSoftClip;
+
+	return 0;
+}
+
+//SAM text of packed operations
+void AppendCigar(string& Out, const vector<uint32_t>& Ops) {
+	for (unsigned n = 0; n < Ops.size(); ++n) {
+		AppendNumber(Out, Ops[n] >> 4);
+		Out += "MIDNSHP=X"[Ops[n] & 0xf];
+	}
+}
@@ -7,13 +7,27 @@
 */
 
 #include <string>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "AmpliconAlignerV2.h"
 
 using namespace std;
 
-bool isReadNMasked(const string& read) {
+bool isReadNMasked(string_view read) {
 
-	for (unsigned n = 0; n < read.size(); ++n) {
+	size_t n = 0;
+
+#ifdef __SSE2__
+	for (; n + 16 <= read.size(); n += 16) {
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (read.data() + n)), _mm_set1_epi8('N'))) != 0xffff) {
+			return false;
+		}
+	}
+#endif
+
+	for (; n < read.size(); ++n) {
 		if (read[n] != 'N') {
 			return false;
 		}
@@ -7,12 +7,32 @@
 */
 
 #include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
 bool isStringDNA(const string& str) { //check DNA sequence input
 
-	for (unsigned short n = 0; n < str.length(); n++) {
+	size_t n = 0; //reference sequences can be longer than 65535bp
+
+#ifdef __SSE2__
+	const __m128i A = _mm_set1_epi8('A'), C = _mm_set1_epi8('C'), G = _mm_set1_epi8('G'), T = _mm_set1_epi8('T');
+
+	for (; n + 16 <= str.length(); n += 16) {
+
+		__m128i Bases = _mm_loadu_si128((const __m128i*) (str.data() + n));
+
+		if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(Bases, A), _mm_cmpeq_epi8(Bases, C)),
+			_mm_or_si128(_mm_cmpeq_epi8(Bases, G), _mm_cmpeq_epi8(Bases, T)))) != 0xffff) {
+			return 1; //ERROR: contains non-standard base
+		}
+
+	}
+#endif
+
+	for (; n < str.length(); n++) {
 
 		if (str[n] != 'A' && str[n] != 'T' && str[n] != 'G' && str[n] != 'C') {
 			return 1; //ERROR: contains non-standard base